@@ -0,0 +1,168 @@
+#!/bin/sh
+# End-to-end benchmark: runs xs-timeout against a private Xvfb, drives it with
+# synthetic XTest input and prints one JSON object on stdout.
+#
+# BIN, XBENCH, CYCLES, THRESHOLDS (timeouts at 1..N steps), STEP (ms, 1000 by
+# default, e.g. 250 for sub-second thresholds), COMMANDS (per timeout and for
+# reset) and XS_ARGS (extra xs-timeout options) can be set from the
+# environment.
+set -eu
+
+BIN=${BIN:-./xs-timeout}
+XBENCH=${XBENCH:-./bench/xbench}
+CYCLES=${CYCLES:-5}
+THRESHOLDS=${THRESHOLDS:-3}
+STEP=${STEP:-1000}
+COMMANDS=${COMMANDS:-4}
+XS_ARGS=${XS_ARGS:-}
+DISPLAY_NUM=${DISPLAY_NUM:-$(($$ % 1000 + 100))}
+
+tmp=$(mktemp -d)
+stamps="$tmp/stamps"
+xvfb_pid=
+xs_pid=
+
+cleanup() {
+  if [ -n "$xs_pid" ]; then kill "$xs_pid" 2>/dev/null || true; fi
+  if [ -n "$xvfb_pid" ]; then kill "$xvfb_pid" 2>/dev/null || true; fi
+  rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+Xvfb ":$DISPLAY_NUM" -nolisten tcp -screen 0 320x240x24 >/dev/null 2>&1 &
+xvfb_pid=$!
+i=0
+while [ ! -S "/tmp/.X11-unix/X$DISPLAY_NUM" ]; do
+  i=$((i + 1))
+  if [ $i -gt 100 ]; then
+    echo "Xvfb didn't start" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+export DISPLAY=":$DISPLAY_NUM"
+
+# a cycle lasts until the last threshold, plus a second
+cycle=$((THRESHOLDS * STEP + 1000))
+cycle=$((cycle / 1000)).$(printf %03d $((cycle % 1000)))
+
+# all the thresholds and resets stamp the time they run at
+set --
+t=1
+while [ $t -le "$THRESHOLDS" ]; do
+  c=1
+  while [ $c -le "$COMMANDS" ]; do
+    set -- "$@" "$((t * STEP))ms:exec $XBENCH stamp timeout-$((t * STEP)) $stamps"
+    c=$((c + 1))
+  done
+  t=$((t + 1))
+done
+c=1
+while [ $c -le "$COMMANDS" ]; do
+  set -- "$@" "reset:exec $XBENCH stamp reset $stamps"
+  c=$((c + 1))
+done
+
+# shellcheck disable=SC2086
+"$BIN" $XS_ARGS "$@" 2>"$tmp/stderr" &
+xs_pid=$!
+sleep 0.5
+
+cpu_ticks() {
+  awk '{ print $14 + $15 }' "/proc/$xs_pid/stat"
+}
+
+wakeups() {
+  cat /proc/"$xs_pid"/task/*/status |
+    awk '/ctxt_switches/ { n += $2 } END { print n }'
+}
+
+# warm-up cycle: the first one is relative to the counter at startup
+"$XBENCH" input "$tmp/warmup"
+sleep "$cycle"
+
+"$XBENCH" stamp begin "$stamps"
+cpu0=$(cpu_ticks)
+wake0=$(wakeups)
+
+n=0
+while [ $n -lt "$CYCLES" ]; do
+  "$XBENCH" input "$stamps"
+  sleep "$cycle"
+  n=$((n + 1))
+done
+
+cpu1=$(cpu_ticks)
+wake1=$(wakeups)
+kill -USR1 "$xs_pid"
+sleep 0.3
+
+awk -v cycles="$CYCLES" -v thresholds="$THRESHOLDS" -v step="$STEP" \
+  -v commands="$COMMANDS" \
+  -v cpu="$((cpu1 - cpu0))" -v hz="$(getconf CLK_TCK)" \
+  -v wakeups="$((wake1 - wake0))" -v stderr="$tmp/stderr" '
+  # the number after key in s, wherever the key is in the line
+  function value(s, key,  i) {
+    i = index(s, key)
+    return i ? substr(s, i + length(key)) + 0 : 0
+  }
+  $1 == "begin" { begun = 1; next }
+  !begun { next }
+  $1 == "input" { input = $2; next }
+  {
+    if ($1 == "reset") {
+      kind = "reset"
+      lat = ($2 - input) / 1000
+    } else {
+      kind = "timeout"
+      t = substr($1, 9)
+      lat = ($2 - input - t * 1000000) / 1000
+      # the firing error: an alarm early by a few ms counts too
+      err = lat < 0 ? -lat : lat
+      err_sum += err
+      if (err > err_max) err_max = err
+    }
+    sum[kind] += lat
+    cnt[kind]++
+    if (lat > max[kind]) max[kind] = lat
+  }
+  END {
+    while ((getline line < stderr) > 0) {
+      if (index(line, "cycles: ")) {
+        # the counts of the last cycle, not the totals
+        requests = value(substr(line, index(line, "requests: ")), \
+          "(last cycle ")
+        round_trips = value(substr(line, index(line, "round trips: ")), \
+          "(last cycle ")
+      } else if (line ~ /^(reset|[0-9]+(ms)?): n=/) {
+        k = line ~ /^reset/ ? "reset" : "timeout"
+        n = value(line, " n=")
+        spawn_sum[k] += value(line, " mean=") * n
+        spawn_cnt[k] += n
+        if (value(line, " max=") > spawn_max[k]) {
+          spawn_max[k] = value(line, " max=")
+        }
+      }
+    }
+    printf "{\"bench\": \"e2e\", \"cycles\": %d, \"thresholds\": %d, ", \
+      cycles, thresholds
+    printf "\"step_ms\": %d, \"commands\": %d, ", step, commands
+    printf "\"detection_us\": {"
+    printf "\"timeout\": {\"mean\": %.1f, \"max\": %.1f}, ", \
+      cnt["timeout"] ? sum["timeout"] / cnt["timeout"] : 0, max["timeout"]
+    printf "\"reset\": {\"mean\": %.1f, \"max\": %.1f}}, ", \
+      cnt["reset"] ? sum["reset"] / cnt["reset"] : 0, max["reset"]
+    printf "\"firing_error_us\": {\"mean\": %.1f, \"max\": %.1f}, ", \
+      cnt["timeout"] ? err_sum / cnt["timeout"] : 0, err_max
+    printf "\"spawn_us\": {"
+    printf "\"timeout\": {\"mean\": %.1f, \"max\": %d}, ", \
+      spawn_cnt["timeout"] ? spawn_sum["timeout"] / spawn_cnt["timeout"] : 0, \
+      spawn_max["timeout"]
+    printf "\"reset\": {\"mean\": %.1f, \"max\": %d}}, ", \
+      spawn_cnt["reset"] ? spawn_sum["reset"] / spawn_cnt["reset"] : 0, \
+      spawn_max["reset"]
+    printf "\"cpu_ms_per_cycle\": %.3f, ", cpu * 1000 / hz / cycles
+    printf "\"wakeups_per_cycle\": %.1f, ", wakeups / cycles
+    printf "\"x_requests_per_cycle\": %d, ", requests
+    printf "\"x_round_trips_per_cycle\": %d}\n", round_trips
+  }' "$stamps"
@@ -0,0 +1,248 @@
+/*
+ * Spawn latency benchmark: compares the legacy vfork + setsid + fork + close
+ * loop with the posix_spawn engine in src/launch.c, directly and through the
+ * zygote, each of them through /bin/sh and, for the last two, with the command
+ * exec'd directly. The burst rows start BURST commands at once, one by one
+ * and as a single batch, like a user coming back after a suspend.
+ *
+ * The latency of one sample is the time from the spawn call to the moment the
+ * command has been exec'd and written a byte on its stdout, which is a pipe
+ * read by the benchmark.
+ */
+#include "action.h"
+#include "arena.h"
+#include "command.h"
+#include "launch.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CMD "printf x"
+#define BURST 16
+
+/* The commands of the benchmark are never actions */
+const Action *action_find(__attribute__((unused)) const char *line,
+                          __attribute__((unused)) const char **arg) {
+  return NULL;
+}
+
+int legacy_daemonize(char *cmd) {
+  pid_t pid;
+
+  pid = vfork();
+
+  if (pid < 0) {
+    return pid;
+  }
+
+  if (pid > 0) {
+    int status;
+    int res = waitpid(pid, &status, 0);
+    if (res < 0) {
+      return res;
+    }
+    return WEXITSTATUS(status);
+  }
+
+  if (setsid() < 0) {
+    exit(-1);
+  }
+
+  signal(SIGCHLD, SIG_IGN);
+  signal(SIGHUP, SIG_IGN);
+
+  pid = fork();
+
+  if (pid < 0) {
+    exit(pid);
+  }
+
+  if (pid > 0) {
+    exit(0);
+  }
+
+  umask(0);
+
+  for (int x = sysconf(_SC_OPEN_MAX); x >= 0; x--) {
+    if (x != fileno(stdout) && x != fileno(stderr)) {
+      close(x);
+    }
+  }
+
+  exit(execl("/bin/sh", "/bin/sh", "-c", cmd, NULL));
+}
+
+int new_spawn(char *cmd) { return launch_shell(cmd, NULL) > 0 ? 0 : -1; }
+
+static Command direct;
+static Command shell;
+
+int direct_spawn(__attribute__((unused)) char *cmd) {
+  return launch_command(&direct, NULL) > 0 ? 0 : -1;
+}
+
+static const Command *burst[BURST];
+
+int burst_spawn(__attribute__((unused)) char *cmd) {
+  for (size_t i = 0; i < BURST; ++i) {
+    if (launch_command(burst[i], NULL) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int batch_spawn(__attribute__((unused)) char *cmd) {
+  return launch_batch(burst, BURST, NULL) > 0 ? 0 : -1;
+}
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* A sample ends when `bytes` commands have written their byte */
+int run(FILE *report, const char *name, int (*fn)(char *), int rfd,
+        size_t iterations, size_t bytes) {
+  uint64_t *samples = calloc(iterations, sizeof(uint64_t));
+  uint64_t total = 0;
+  char buf[BURST];
+
+  for (size_t i = 0; i < iterations; ++i) {
+    uint64_t start = now_ns();
+    if (fn(CMD) < 0) {
+      perror(name);
+      free(samples);
+      return -1;
+    }
+    for (size_t left = bytes; left;) {
+      ssize_t n = read(rfd, buf, left);
+      if (n <= 0) {
+        perror(name);
+        free(samples);
+        return -1;
+      }
+      left -= n;
+    }
+    samples[i] = now_ns() - start;
+    total += samples[i];
+  }
+
+  qsort(samples, iterations, sizeof(uint64_t), cmp_u64);
+  fprintf(report, "{\"bench\": \"spawn\", \"engine\": \"%s\", \"iterations\": %zu, "
+         "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f}\n",
+         name, iterations, total / 1000.0 / iterations,
+         samples[iterations / 2] / 1000.0,
+         samples[iterations * 99 / 100] / 1000.0);
+  fflush(report);
+
+  free(samples);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 100;
+  struct rlimit rl;
+  FILE *report;
+  int fds[2], out;
+
+  if (!iterations) {
+    iterations = 1;
+  }
+
+  /* Like a desktop session with a high nofile limit */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  fprintf(stderr, "RLIMIT_NOFILE: %ld\n", sysconf(_SC_OPEN_MAX));
+
+  if (pipe(fds) < 0 || (out = dup(STDOUT_FILENO)) < 0) {
+    perror("pipe");
+    return 1;
+  }
+  /* Spawned commands keep stdout, so it becomes the pipe we time */
+  dup2(fds[1], STDOUT_FILENO);
+  close(fds[1]);
+  report = fdopen(out, "w");
+
+  Arena *arena = arena_new();
+  command_compile(arena, &direct, CMD, COMMAND_AUTO, 0);
+  command_compile(arena, &shell, CMD, COMMAND_SHELL, 0);
+  if (!direct.argv) {
+    fprintf(stderr, "'%s` cannot be exec'd directly\n", CMD);
+    return 1;
+  }
+
+  if (run(report, "legacy", legacy_daemonize, fds[0], iterations, 1) < 0) {
+    return 1;
+  }
+
+  /* After the legacy run: SA_NOCLDWAIT would break its waitpid */
+  if (launch_init() < 0) {
+    perror("launch_init");
+    return 1;
+  }
+
+  if (run(report, "posix_spawn", new_spawn, fds[0], iterations, 1) < 0) {
+    return 1;
+  }
+
+  if (run(report, "exec", direct_spawn, fds[0], iterations, 1) < 0) {
+    return 1;
+  }
+
+  if (launch_zygote_start() < 0) {
+    perror("launch_zygote_start");
+    return 1;
+  }
+
+  if (run(report, "zygote", new_spawn, fds[0], iterations, 1) < 0) {
+    return 1;
+  }
+
+  if (run(report, "zygote_exec", direct_spawn, fds[0], iterations, 1) < 0) {
+    return 1;
+  }
+
+  /* mostly shell commands, as in the usual configuration */
+  for (size_t i = 0; i < BURST; ++i) {
+    burst[i] = i % 4 ? &shell : &direct;
+  }
+
+  if (run(report, "burst_zygote", burst_spawn, fds[0], iterations, BURST) <
+      0) {
+    return 1;
+  }
+
+  if (run(report, "batch_zygote", batch_spawn, fds[0], iterations, BURST) <
+      0) {
+    return 1;
+  }
+
+  launch_destroy();
+
+  if (run(report, "burst", burst_spawn, fds[0], iterations, BURST) < 0) {
+    return 1;
+  }
+
+  if (run(report, "batch", batch_spawn, fds[0], iterations, BURST) < 0) {
+    return 1;
+  }
+
+  arena_free(arena);
+  return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Helper of the end-to-end benchmark (bench/e2e.sh):
+ *
+ *   xbench stamp <label> <file>  append "<label> <CLOCK_MONOTONIC ns>"
+ *   xbench input <file>          inject a pointer motion through XTest on
+ *                                $DISPLAY and append "input <ns>"
+ */
+#include "util.h"
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int append_stamp(const char *label, const char *file) {
+  char line[128];
+  int fd, len;
+
+  len = snprintf(line, sizeof(line), "%s %lu\n", label, monotonic_ns());
+  if ((fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+    perror(file);
+    return 1;
+  }
+
+  /* O_APPEND and a single write: lines from concurrent commands don't mix */
+  if (write(fd, line, len) != len) {
+    perror(file);
+    close(fd);
+    return 1;
+  }
+
+  close(fd);
+  return 0;
+}
+
+int inject_input(const char *file) {
+  static int x = 0;
+  int event_base, error_base, major, minor;
+  Display *dpy;
+
+  if (!(dpy = XOpenDisplay(NULL))) {
+    eprintf("Cannot open display\n");
+    return 1;
+  }
+
+  if (!XTestQueryExtension(dpy, &event_base, &error_base, &major, &minor)) {
+    eprintf("Your server doesn't support XTEST extension\n");
+    XCloseDisplay(dpy);
+    return 1;
+  }
+
+  x = (x + 7) % 100;
+  XTestFakeMotionEvent(dpy, -1, 100 + x, 100 + x, CurrentTime);
+  /* the motion has been processed once the reply is here */
+  XSync(dpy, False);
+  XCloseDisplay(dpy);
+
+  return append_stamp("input", file);
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && strcmp(argv[1], "stamp") == 0) {
+    return append_stamp(argv[2], argv[3]);
+  }
+
+  if (argc == 3 && strcmp(argv[1], "input") == 0) {
+    return inject_input(argv[2]);
+  }
+
+  eprintf("USAGE: xbench stamp <label> <file> | xbench input <file>\n");
+  return 2;
+}
@@ -0,0 +1,39 @@
+#ifndef __XS_ACTION__
+#define __XS_ACTION__
+
+#include "source.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Where and when an action runs */
+typedef struct action_context {
+  /* idle source of the session */
+  Source *source;
+  /* ms, 0 for the resets */
+  uint64_t threshold;
+  /* ms of idleness */
+  uint64_t idle;
+} ActionContext;
+
+/*
+ * Built-in actions are written `@name <argument>` in place of a command. They
+ * run in the main thread, right after the commands of the same transition are
+ * queued, on the connection of the session: no process is created.
+ */
+typedef struct action {
+  const char *name;
+  /* given back to every operation */
+  void *data;
+  /* the argument is valid, otherwise prints why */
+  bool (*check)(void *, const char *);
+  void (*run)(void *, const char *, ActionContext *);
+  /* optional: the user came back, undo what the runs left behind */
+  void (*reset)(void *, ActionContext *);
+} Action;
+
+const Action *action_lookup(const char *, size_t);
+const Action *action_find(const char *, const char **);
+bool action_check(const char *);
+void action_reset(ActionContext *);
+
+#endif
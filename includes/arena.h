@@ -0,0 +1,39 @@
+#ifndef __XS_ARENA__
+#define __XS_ARENA__
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN sizeof(ArenaAlign)
+
+typedef union arena_align {
+  void *ptr;
+  long long ll;
+  long double ld;
+} ArenaAlign;
+
+/*
+ * Bump allocator: memory is only ever released all at once by arena_free(),
+ * so everything allocated from an arena must share its lifetime.
+ */
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  ArenaAlign data[];
+} ArenaChunk;
+
+typedef struct arena {
+  ArenaChunk *chunks;
+  size_t chunks_len;
+  /* bytes requested from malloc and bytes handed out */
+  size_t allocated;
+  size_t used;
+} Arena;
+
+Arena *arena_new(void);
+void *arena_alloc(Arena *, size_t);
+char *arena_strdup(Arena *, const char *);
+void arena_free(Arena *);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef __XS_BRIGHTNESS__
+#define __XS_BRIGHTNESS__
+
+#include "action.h"
+#include <X11/Xlib.h>
+
+/*
+ * `@brightness <0..1>` sets a linear gamma ramp scaled by the level on every
+ * active CRTC, like `xrandr --output <output> --brightness <level>` does for
+ * one output. The CRTCs are listed once per display and listed again only
+ * after a RRScreenChangeNotify, so dimming or restoring all the monitors is a
+ * single flush of one request per CRTC, without a round trip. The ramps are
+ * read when the CRTCs are listed and put back when the user comes back, so a
+ * ramp changed by another client afterwards is lost until the screen changes.
+ * Needs XRandR at build time (HAVE_XRANDR).
+ */
+typedef struct brightness Brightness;
+
+extern const Action brightness_action;
+
+void brightness_event(Brightness *, XEvent *);
+void brightness_free(Brightness *);
+
+#endif
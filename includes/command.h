@@ -0,0 +1,46 @@
+#ifndef __XS_COMMAND__
+#define __XS_COMMAND__
+
+#include "action.h"
+#include "arena.h"
+#include <stdbool.h>
+
+typedef enum command_mode {
+  /* direct exec when the command needs nothing from the shell */
+  COMMAND_AUTO,
+  COMMAND_SHELL,
+  /* split on blanks and exec'd directly, whatever it contains */
+  COMMAND_EXEC,
+} CommandMode;
+
+/* What to do with the instances of a command still running */
+typedef enum command_policy {
+  /* killed with their process group when the user comes back */
+  COMMAND_KILL = 1 << 0,
+  /* the command is skipped while an instance runs */
+  COMMAND_SINGLE = 1 << 1,
+  /* the running instances are killed and the command started again */
+  COMMAND_RESTART = 1 << 2,
+} CommandPolicy;
+
+/*
+ * A command is classified once, when the configuration is built: simple ones
+ * are split into an argv with the program already looked up in PATH, the
+ * others are run by /bin/sh -c. Lines starting with `@` are actions.
+ */
+typedef struct command {
+  const char *line;
+  /* NULL when the command goes through the shell */
+  char **argv;
+  const char *path;
+  /* CommandPolicy flags, the instances are tracked only when not 0 */
+  unsigned policy;
+  /* built-in action run in place of a process, with its argument */
+  const Action *action;
+  const char *arg;
+} Command;
+
+void command_compile(Arena *, Command *, const char *, CommandMode, unsigned);
+bool command_check(const char *, CommandMode);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __XS_CONTROL__
+#define __XS_CONTROL__
+
+#include "loop.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* longest request, newline included */
+#define CONTROL_LINE_MAX 256
+
+typedef struct control_client {
+  int fd;
+  /* partial request */
+  char buf[CONTROL_LINE_MAX];
+  size_t len;
+  bool subscribed;
+  /* closed after the current event: it hung up or cannot keep up */
+  bool dead;
+  struct control_client *next;
+} ControlClient;
+
+typedef struct control_inhibit {
+  char *owner;
+  unsigned refs;
+  /* CLOCK_MONOTONIC ns, 0 to keep it until released */
+  uint64_t expires;
+  struct control_inhibit *next;
+} ControlInhibit;
+
+typedef struct control_ops {
+  /* the first inhibit was taken or the last one released */
+  void (*inhibit)(bool);
+  void (*reset)(void);
+  /* one `session ...` line per session */
+  void (*query)(ControlClient *);
+} ControlOps;
+
+/*
+ * Unix socket served by the event loop, one request per line:
+ *   inhibit <owner> [<ms>]  takes a reference, released after <ms> if given
+ *   uninhibit <owner>       releases a reference
+ *   reset                   like SIGALRM
+ *   query                   the inhibits and the state of every session
+ *   subscribe               `event ...` lines for every transition
+ * Every request is answered with `ok [...]` or `error <reason>` as the last
+ * line. Replies never block the loop: a client that doesn't read them is
+ * dropped.
+ */
+typedef struct control {
+  Loop *loop;
+  int fd;
+  char *path;
+  /* earliest inhibit expiry */
+  int timer;
+  const ControlOps *ops;
+  ControlClient *clients;
+  ControlInhibit *inhibits;
+} Control;
+
+Control *control_new(Loop *, const char *, const ControlOps *);
+bool control_inhibited(Control *);
+void control_reply(ControlClient *, const char *, ...)
+    __attribute__((format(printf, 2, 3)));
+void control_notify(Control *, const char *, ...)
+    __attribute__((format(printf, 2, 3)));
+void control_free(Control *);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __XS_DISPATCH__
+#define __XS_DISPATCH__
+
+#include "timeouts.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DISPATCH_QUEUE_SIZE 256
+
+/* ms the main loop waits for room in a full queue before dropping a job */
+#define DISPATCH_WAIT_MS 1000
+
+/* commands in a batch, longer ones are split in several batches */
+#define DISPATCH_BATCH_MAX 256
+
+int dispatch_init(bool);
+bool dispatch_push(Callbacks *, size_t, uint64_t, char **);
+void dispatch_reset(Callbacks *, uint64_t, char **);
+void dispatch_destroy(void);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __XS_DPMS__
+#define __XS_DPMS__
+
+#include "action.h"
+
+/*
+ * `@dpms off|standby|suspend|on` forces the power level of the monitors, like
+ * `xset dpms force <level>`, and `@screensaver activate|reset` is
+ * `xset s activate|reset`, both on the connection of the session. When the
+ * user comes back the monitors are forced on and DPMS is disabled again if it
+ * was before the first @dpms of the idle cycle, in a single flush.
+ */
+typedef struct dpms Dpms;
+
+extern const Action dpms_action;
+extern const Action screensaver_action;
+
+void dpms_free(Dpms *);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __XS_HISTOGRAM__
+#define __XS_HISTOGRAM__
+
+#include <stdint.h>
+
+/*
+ * Log-linear (HDR style) histogram of microseconds: values below
+ * 2^HISTOGRAM_SUB_BITS are exact, above that every power of two is split in
+ * 2^HISTOGRAM_SUB_BITS buckets, so the error is below 12.5% up to ~71 minutes.
+ */
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_MAX_BITS 32
+#define HISTOGRAM_BUCKETS                                                      \
+  ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct histogram {
+  uint32_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max;
+} Histogram;
+
+Histogram *histogram_new(void);
+void histogram_record(Histogram *, uint64_t);
+uint64_t histogram_percentile(Histogram *, double);
+int histogram_inspect(Histogram *, int (*)(void *, const char *, ...), void *);
+void histogram_free(Histogram *);
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef __XS_IDLE__
 #define __XS_IDLE__
 
+#include "brightness.h"
+#include "dpms.h"
+#include "source.h"
 #include <X11/Xlib.h>
 #include <X11/extensions/sync.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum idle_state {
@@ -10,26 +15,65 @@ typedef enum idle_state {
   IDLE_TIMEOUT,
 } IdleState;
 
+typedef struct idle_alarm {
+  XSyncAlarm alarm;
+  int64_t timeout;
+  unsigned long serial;
+  bool active;
+} IdleAlarm;
+
 typedef struct idle {
   Display *dpy;
   int event_base;
   int error_base;
   int64_t base_timer;
+  bool base_known;
   XSyncCounter idle_counter;
   IdleState idle_state;
+  bool paused;
+  /* the connection is broken, only idle_close() can be called */
+  bool dead;
   XSyncAlarm zero_alarm;
   XSyncAlarm timeout_alarm;
+  unsigned long zero_serial;
+  unsigned long timeout_serial;
+  int64_t timeout_target;
+  int64_t target;
+  /* CLOCK_MONOTONIC ns of the last reported transition */
+  uint64_t event_time;
+  /* ms of idleness at the last threshold event */
+  int64_t idle_time;
+  /* multi-alarm mode: one alarm per threshold, programmed up front */
+  IdleAlarm *alarms;
+  size_t alarms_len;
+  int64_t alarms_base;
+  int64_t reached;
+  bool alarms_armed;
+  /* @brightness state, NULL until the first run */
+  Brightness *brightness;
+  /* @dpms state, NULL until the first run */
+  Dpms *dpms;
+  IdleStats stats;
+  /* last request seen answered by idle_after_request() */
+  unsigned long round_trip_serial;
+  /* open displays, looked up by the Xlib after function */
+  struct idle *next;
 } Idle;
 
-typedef enum select_result {
-  ERROR,
-  TIMEOUT,
-  UNIDLE,
-} SelectResult;
-
-Idle *idle_create(void);
-SelectResult idle_wait(Idle *, uint32_t);
+Idle *idle_create(const char *, const uint64_t *, size_t);
+int idle_fd(Idle *);
+bool idle_arm(Idle *, uint64_t);
+SelectResult idle_dispatch(Idle *);
 void idle_reset(Idle *idle);
+void idle_pause(Idle *);
+void idle_resume(Idle *);
+bool idle_set_thresholds(Idle *, const uint64_t *, size_t);
+uint64_t idle_event_time(Idle *);
+uint64_t idle_idle_time(Idle *);
+uint64_t idle_idle_after(Idle *);
+void idle_dismiss(Idle *);
+IdleStats *idle_stats(Idle *);
 void idle_close(Idle *);
+Idle *xsync_idle(Source *);
 
 #endif
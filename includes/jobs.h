@@ -0,0 +1,31 @@
+#ifndef __XS_JOBS__
+#define __XS_JOBS__
+
+#include "command.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Instances of the commands with a policy, tracked by the thread launching the
+ * commands (and by the main loop when the dispatch queue is full). Every
+ * instance leads its own session, so the whole pipeline started by a command
+ * is killed with its process group, until the leader is found dead and
+ * reaped.
+ */
+typedef struct job {
+  /* the instances of a command outlive a configuration reload */
+  char *line;
+  /* the session the command was started for */
+  char **envp;
+  unsigned policy;
+  pid_t pid;
+  int pidfd;
+  /* SIGTERM sent, kept until it exits to be reaped */
+  bool killed;
+} Job;
+
+pid_t jobs_launch(const Command *, char **envp);
+void jobs_reset(char **envp);
+void jobs_destroy(void);
+
+#endif
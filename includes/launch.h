@@ -0,0 +1,19 @@
+#ifndef __XS_LAUNCH__
+#define __XS_LAUNCH__
+
+#include "command.h"
+#include <sys/types.h>
+
+#define LAUNCH_ZYGOTE_MSG_MAX 65536
+/* longer argvs are spawned directly even in zygote mode */
+#define LAUNCH_ZYGOTE_ARGS_MAX 64
+
+int launch_init(void);
+int launch_zygote_start(void);
+pid_t launch_shell(const char *cmd, char *const *envp);
+pid_t launch_command(const Command *, char *const *envp);
+pid_t launch_tracked(const Command *, char *const *envp, int *pidfd);
+pid_t launch_batch(const Command *const *, size_t, char *const *envp);
+void launch_destroy(void);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __XS_LOOP__
+#define __XS_LOOP__
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/signalfd.h>
+
+typedef struct loop Loop;
+
+typedef void (*LoopCallback)(Loop *, int, uint32_t, void *);
+typedef void (*LoopSignalCallback)(Loop *, struct signalfd_siginfo *, void *);
+
+Loop *loop_create(void);
+int loop_add(Loop *, int, uint32_t, LoopCallback, void *);
+int loop_del(Loop *, int);
+int loop_signals(Loop *, const sigset_t *, LoopSignalCallback, void *);
+int loop_timer(Loop *, LoopCallback, void *);
+int loop_timer_arm(int, uint64_t);
+int loop_run(Loop *);
+void loop_stop(Loop *, int);
+void loop_destroy(Loop *);
+
+#endif
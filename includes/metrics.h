@@ -0,0 +1,46 @@
+#ifndef __XS_METRICS__
+#define __XS_METRICS__
+
+#include "source.h"
+#include "timeouts.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* transitions are counted by SelectResult, PENDING is never exported */
+#define METRICS_STATES (FINISHED + 1)
+
+typedef struct metrics_session {
+  char *name;
+  uint64_t transitions[METRICS_STATES];
+  /* X requests and round trips, all the connections of the session */
+  uint64_t requests;
+  uint64_t round_trips;
+  uint64_t reconnects;
+  /* ms, from the last event of the source, without asking the server */
+  uint64_t idle;
+  /* ms, the last threshold reached, 0 while the user is active */
+  uint64_t threshold;
+} MetricsSession;
+
+/*
+ * Snapshot of the main loop state, rendered to a Prometheus textfile by the
+ * metrics thread, so the main loop never touches the filesystem. The timeouts
+ * are referenced for their spawn counters and latency histograms, updated by
+ * the spawner thread.
+ */
+typedef struct metrics {
+  const char *path;
+  Timeouts *timeouts;
+  MetricsSession *sessions;
+  size_t sessions_len;
+} Metrics;
+
+Metrics *metrics_new(const char *, Timeouts *, size_t);
+bool metrics_write(Metrics *);
+int metrics_start(void);
+bool metrics_post(Metrics *);
+void metrics_stop(void);
+void metrics_free(Metrics *);
+
+#endif
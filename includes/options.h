@@ -7,9 +7,33 @@
 typedef struct options {
   bool help;
   bool version;
+  /* an invalid option, already reported */
+  bool error;
+  bool zygote;
+  bool multi_alarm;
+  bool batch;
+  /* reset debounce, in ms */
+  uint32_t reset_activity;
+  uint32_t reset_interval;
+  /* one session per display and per simulation script */
+  char **displays;
+  size_t displays_len;
+  char **simulate;
+  size_t simulate_len;
+  char *config;
+  /* control socket path */
+  char *control;
+  /* trace file, default $XDG_RUNTIME_DIR/xs-timeout.trace */
+  char *trace;
+  /* Prometheus textfile */
+  char *metrics;
+  /* timeouts given on the command line */
+  char **args;
+  size_t args_len;
   Timeouts *timeouts;
 } Options;
 
 Options parse_options(int argc, char **argv);
+Timeouts *load_timeouts(const char *, char **, size_t);
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef __XS_PLUGIN__
+#define __XS_PLUGIN__
+
+#include "action.h"
+#include "xs-timeout-plugin.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* initial capacity of the queue, doubled whenever it is full */
+#define PLUGIN_QUEUE_SIZE 256
+
+typedef struct plugin {
+  void *handle;
+  void (*exit)(void);
+} Plugin;
+
+/* An action registered by a plugin, as seen by the configuration */
+typedef struct plugin_action {
+  Action action;
+  XsPluginAction def;
+} PluginAction;
+
+/* Queued for the worker thread */
+typedef struct plugin_call {
+  const PluginAction *action;
+  uint64_t threshold;
+  uint64_t idle;
+  /* a copy: the configuration can be reloaded meanwhile */
+  char *arg;
+} PluginCall;
+
+bool plugin_load(const char *);
+const Action *plugin_find(const char *, size_t);
+void plugin_destroy(void);
+
+#endif
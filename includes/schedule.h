@@ -0,0 +1,35 @@
+#ifndef __XS_SCHEDULE__
+#define __XS_SCHEDULE__
+
+#include "timeouts.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Immutable runtime form of the configuration: reset commands are split out
+ * and the thresholds are laid out in ascending order, so the main loop only
+ * keeps the index of the next threshold (a cursor) and every transition is a
+ * direct lookup.
+ */
+typedef struct schedule {
+  /* owns the commands, frozen once the schedule is compiled */
+  Timeouts *timeouts;
+  Callbacks *reset;
+  /* steps[i].timeout == thresholds[i], both in ascending order */
+  Callbacks *steps;
+  uint64_t *thresholds;
+  size_t len;
+} Schedule;
+
+Schedule *schedule_compile(Timeouts *);
+uint64_t schedule_threshold(Schedule *, size_t);
+size_t schedule_cursor(Schedule *, uint64_t);
+size_t schedule_advance(Schedule *, size_t, uint64_t);
+size_t schedule_remap(Schedule *, Schedule *, size_t);
+size_t schedule_exec(Schedule *, size_t, size_t, uint64_t, char **, Source *);
+size_t schedule_exec_reset(Schedule *, uint64_t, char **, Source *);
+int schedule_inspect_latency(Schedule *, int (*)(void *, const char *, ...),
+                             void *);
+void schedule_free(Schedule *);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __XS_SIM__
+#define __XS_SIM__
+
+#include "source.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Simulated idle source: time only advances when the scheduler asks for the
+ * next transition, so a script describing hours of activity is replayed as
+ * fast as the commands can be dispatched.
+ */
+typedef struct sim_step {
+  /* ms of idleness before the input */
+  int64_t idle;
+  /* the machine sleeps meanwhile: thresholds are seen at wake up */
+  bool asleep;
+} SimStep;
+
+typedef struct sim {
+  int fd;
+  /* replayed `repeat` times */
+  SimStep *script;
+  size_t len;
+  size_t allocated;
+  size_t pos;
+  uint64_t repeat;
+  uint64_t round;
+  /* simulated clock and idle counter, in ms */
+  int64_t now;
+  int64_t last_input;
+  int64_t target;
+  bool timed_out;
+  bool paused;
+  /* a transition was just reported: give the loop a turn before the next */
+  bool yield;
+  uint64_t event_time;
+  int64_t idle_time;
+  IdleStats stats;
+} Sim;
+
+Sim *sim_create(const char *);
+int sim_fd(Sim *);
+bool sim_arm(Sim *, uint64_t);
+SelectResult sim_dispatch(Sim *);
+void sim_reset(Sim *);
+void sim_pause(Sim *);
+void sim_resume(Sim *);
+uint64_t sim_idle_after(Sim *, uint32_t);
+void sim_dismiss(Sim *);
+IdleStats *sim_stats(Sim *);
+void sim_close(Sim *);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __XS_SOURCE__
+#define __XS_SOURCE__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum select_result {
+  ERROR,
+  TIMEOUT,
+  UNIDLE,
+  PENDING,
+  /* the backend has no more activity to report (e.g. end of a script) */
+  FINISHED,
+} SelectResult;
+
+typedef struct idle_stats {
+  uint64_t cycles;
+  uint64_t requests;
+  uint64_t round_trips;
+  /* last complete idle -> timeout -> reset cycle */
+  uint64_t cycle_requests;
+  uint64_t cycle_round_trips;
+  /* request serials at startup and at the start of the current cycle */
+  unsigned long start_request;
+  unsigned long cycle_start_request;
+  uint64_t cycle_start_round_trips;
+} IdleStats;
+
+/*
+ * An idle source tells when the user has been idle for a given time and when
+ * they come back. Backends are driven from the event loop: arm() programs the
+ * next wait, then dispatch() is called whenever fd() becomes readable until it
+ * returns PENDING.
+ */
+typedef struct source_backend {
+  const char *name;
+  void *(*create)(const char *, const uint64_t *, size_t);
+  int (*fd)(void *);
+  bool (*arm)(void *, uint64_t);
+  SelectResult (*dispatch)(void *);
+  void (*reset)(void *);
+  void (*pause)(void *);
+  void (*resume)(void *);
+  /* CLOCK_MONOTONIC ns of the last reported transition */
+  uint64_t (*event_time)(void *);
+  /* ms of idleness when the last TIMEOUT was reported */
+  uint64_t (*idle_time)(void *);
+  /* paused, ms of idleness the given ms after the last UNIDLE */
+  uint64_t (*idle_after)(void *, uint32_t);
+  /* the last UNIDLE is ignored: the next activity is reported again */
+  void (*dismiss)(void *);
+  /* optional: the thresholds given to create() changed */
+  bool (*set_thresholds)(void *, const uint64_t *, size_t);
+  IdleStats *(*stats)(void *);
+  void (*close)(void *);
+} SourceBackend;
+
+typedef struct source {
+  const SourceBackend *backend;
+  void *impl;
+} Source;
+
+extern const SourceBackend xsync_backend;
+extern const SourceBackend sim_backend;
+
+Source *source_create(const SourceBackend *, const char *, const uint64_t *,
+                      size_t);
+int source_fd(Source *);
+bool source_arm(Source *, uint64_t);
+SelectResult source_dispatch(Source *);
+void source_reset(Source *);
+void source_pause(Source *);
+void source_resume(Source *);
+uint64_t source_event_time(Source *);
+uint64_t source_idle_time(Source *);
+uint64_t source_idle_after(Source *, uint32_t);
+void source_dismiss(Source *);
+bool source_set_thresholds(Source *, const uint64_t *, size_t);
+IdleStats *source_stats(Source *);
+void source_close(Source *);
+
+#endif
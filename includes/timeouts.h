@@ -1,39 +1,69 @@
 #ifndef __XS_TIMEOUT_CALLBACKS__
 #define __XS_TIMEOUT_CALLBACKS__
 
+#include "arena.h"
+#include "command.h"
+#include "histogram.h"
+#include "source.h"
 #include <stddef.h>
 #include <stdint.h>
 
 typedef struct callbacks {
-  uint32_t timeout;
-  char **cmds;
+  struct timeouts *owner;
+  /* ms */
+  uint64_t timeout;
+  Command *cmds;
   size_t len;
-  size_t allocated;
+  /* cmds that are built-in actions, run by the main thread */
+  size_t actions;
+  /* from the alarm (or the activity) to each child running, in us */
+  Histogram *latency;
+  /* processes started and failed, updated like the histogram */
+  uint64_t spawned;
+  uint64_t failed;
 } Callbacks;
 
+typedef struct timeout_entry {
+  uint64_t timeout;
+  size_t seq;
+  CommandMode mode;
+  unsigned policy;
+  char *cmd;
+  struct timeout_entry *next;
+} TimeoutEntry;
+
+/*
+ * Commands are collected as entries in parse order, then timeouts_build()
+ * groups them by timeout. Everything but the latency histograms lives in the
+ * arena and goes away with it, when the last reference is dropped: queued
+ * jobs keep the timeouts alive across a configuration reload.
+ */
 typedef struct timeouts {
+  unsigned int refs;
+  Arena *arena;
+  TimeoutEntry *entries;
+  TimeoutEntry **entries_tail;
+  size_t entries_len;
+  /* sorted by timeout, filled by timeouts_build() */
   Callbacks *callbacks;
   size_t len;
-  size_t allocated;
 } Timeouts;
 
 Timeouts *timeouts_new(void);
 size_t timeouts_len(Timeouts *);
-void timeouts_shrink_to_fit(Timeouts *);
+Timeouts *timeouts_ref(Timeouts *);
 void timeouts_free(Timeouts *);
-void timeouts_append(Timeouts *, uint32_t, char *);
-void timeouts_dup_append(Timeouts *, uint32_t, char *);
-Callbacks *timeouts_get(Timeouts *, uint32_t);
-size_t timeouts_exec_reset(Timeouts *);
-size_t timeouts_exec(Timeouts *, uint32_t, uint32_t);
-uint32_t timeouts_next(Timeouts *, uint32_t);
+void timeouts_dup_append(Timeouts *, uint64_t, const char *, CommandMode,
+                         unsigned);
+void timeouts_build(Timeouts *);
+size_t timeouts_footprint(Timeouts *);
+Callbacks *timeouts_get(Timeouts *, uint64_t);
 int timeouts_inspect(Timeouts *, int (*)(void *, const char *, ...), void *);
 
-void callbacks_shrink_to_fit(Callbacks *);
-void callbacks_dup_append(Callbacks *, char *);
-void callbacks_append(Callbacks *, char *);
 size_t callbacks_len(Callbacks *);
-size_t callbacks_exec(Callbacks *);
+size_t callbacks_exec(Callbacks *, size_t, uint64_t, char **, Source *);
+size_t callbacks_reset(Callbacks *, uint64_t, char **, Source *);
+int timeout_inspect(uint64_t, int (*)(void *, const char *, ...), void *);
 int callbacks_inspect(Callbacks *, int (*)(void *, const char *, ...), void *);
 
 #endif
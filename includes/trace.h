@@ -0,0 +1,58 @@
+#ifndef __XS_TRACE__
+#define __XS_TRACE__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "XSTRACE"
+#define TRACE_VERSION 1
+/* power of two, 160 KiB of records */
+#define TRACE_RECORDS 4096
+
+typedef enum trace_type {
+  /* id: alarm, a: wait value (0 for the activity alarm), b: 1 if relative */
+  TRACE_ALARM_ARMED = 1,
+  /* id: alarm, a: counter value, b: alarm value */
+  TRACE_ALARM_FIRED,
+  /* id: SelectResult, a: session, b: cursor when it was reported */
+  TRACE_STATE,
+  /* id: commands, a: pid (-1 on failure), b: ns spent launching */
+  TRACE_SPAWN,
+  /* id: signal, a: sender pid */
+  TRACE_SIGNAL,
+} TraceType;
+
+typedef struct trace_record {
+  /* index + 1, written last: a record with another seq is torn or stale */
+  uint64_t seq;
+  /* CLOCK_MONOTONIC ns */
+  uint64_t time;
+  uint32_t type;
+  uint32_t id;
+  uint64_t a;
+  uint64_t b;
+} TraceRecord;
+
+/*
+ * The trace file is this header followed by TRACE_RECORDS records, written
+ * in place through a shared mapping, so it can be read while xs-timeout runs
+ * and after it died. Records are claimed with an atomic increment of head,
+ * the main loop and the spawner thread both write.
+ */
+typedef struct trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  /* records ever written */
+  uint64_t head;
+  /* CLOCK_REALTIME - CLOCK_MONOTONIC at startup, ns */
+  int64_t realtime_offset;
+} TraceHeader;
+
+char *trace_path(void);
+bool trace_open(const char *);
+void trace_event(TraceType, uint32_t, uint64_t, uint64_t);
+void trace_close(void);
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef __XS_TIMEOUT_UTIL__
 #define __XS_TIMEOUT_UTIL__
 
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #define eprintf(...) fprintf(stderr, __VA_ARGS__)
 
@@ -11,4 +13,10 @@
 #define dprintf(...)
 #endif
 
+static inline uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 #endif
@@ -0,0 +1,21 @@
+#ifndef __XS_WATCH__
+#define __XS_WATCH__
+
+#include <stdbool.h>
+
+/*
+ * Watches a single file through its directory, so files replaced by rename
+ * (as most editors and configuration managers do) are noticed too.
+ */
+typedef struct watch {
+  int fd;
+  int wd;
+  char *name;
+} Watch;
+
+Watch *watch_new(const char *);
+int watch_fd(Watch *);
+bool watch_changed(Watch *);
+void watch_free(Watch *);
+
+#endif
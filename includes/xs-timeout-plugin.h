@@ -0,0 +1,58 @@
+#ifndef __XS_TIMEOUT_PLUGIN__
+#define __XS_TIMEOUT_PLUGIN__
+
+#include <stdint.h>
+
+/*
+ * Stable ABI of the plugins loaded with -p/--plugin. A plugin is a shared
+ * object that declares XS_PLUGIN and defines xs_plugin_init(), from which it
+ * registers its actions: `@name <argument>` in place of a command then calls
+ * the action instead of creating a process. This header is all a plugin
+ * needs, an ABI change bumps XS_PLUGIN_ABI.
+ */
+#define XS_PLUGIN_ABI 1
+
+#define XS_PLUGIN const unsigned xs_plugin_abi = XS_PLUGIN_ABI
+
+/*
+ * The action returns quickly and is called from the event loop, otherwise it
+ * is called from a worker thread shared by the actions of every plugin, one
+ * call at a time, in order.
+ */
+#define XS_PLUGIN_NONBLOCKING (1u << 0)
+
+/* Valid for the duration of the call */
+typedef struct xs_plugin_event {
+  /* ms, 0 for a reset */
+  uint64_t threshold;
+  /* ms of idleness */
+  uint64_t idle;
+  /* what follows `@name` */
+  const char *arg;
+} XsPluginEvent;
+
+typedef struct xs_plugin_action {
+  /* no blanks, the builtin names are taken */
+  const char *name;
+  unsigned flags;
+  void *data;
+  /* optional: 0 when the argument is valid, when the configuration is read */
+  int (*check)(void *data, const char *arg);
+  void (*run)(void *data, const XsPluginEvent *event);
+} XsPluginAction;
+
+typedef struct xs_plugin_host {
+  unsigned abi;
+  /*
+   * The action is copied, the name and the data must stay valid until the
+   * plugin is unloaded. Returns 0 on success.
+   */
+  int (*register_action)(const XsPluginAction *action);
+} XsPluginHost;
+
+/* Returns 0 on success, the plugin is unloaded otherwise */
+int xs_plugin_init(const XsPluginHost *host);
+/* optional, called once no action can run anymore */
+void xs_plugin_exit(void);
+
+#endif
@@ -0,0 +1,69 @@
+#include "action.h"
+#include "brightness.h"
+#include "dpms.h"
+#include "plugin.h"
+#include "util.h"
+#include <string.h>
+
+#define ACTION_BLANKS " \t"
+
+static const Action *const actions[] = {
+    &brightness_action,
+    &dpms_action,
+    &screensaver_action,
+};
+
+/* Builtin actions first, then the ones registered by the plugins */
+const Action *action_lookup(const char *name, size_t len) {
+  for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); ++i) {
+    if (strlen(actions[i]->name) == len &&
+        strncmp(actions[i]->name, name, len) == 0) {
+      return actions[i];
+    }
+  }
+
+  return plugin_find(name, len);
+}
+
+/* The action of a command line, and its argument */
+const Action *action_find(const char *line, const char **arg) {
+  line += strspn(line, ACTION_BLANKS);
+  if (*line != '@') {
+    return NULL;
+  }
+
+  size_t len = strcspn(++line, ACTION_BLANKS);
+  const Action *res = action_lookup(line, len);
+  if (res) {
+    *arg = line + len + strspn(line + len, ACTION_BLANKS);
+  }
+
+  return res;
+}
+
+/* Commands not starting with `@` are not actions and always pass */
+bool action_check(const char *line) {
+  const char *arg;
+  const Action *action = action_find(line, &arg);
+
+  if (action) {
+    return action->check(action->data, arg);
+  }
+
+  line += strspn(line, ACTION_BLANKS);
+  if (*line == '@') {
+    eprintf("Unknown action '%.*s`\n", (int)strcspn(line, ACTION_BLANKS),
+            line);
+    return false;
+  }
+
+  return true;
+}
+
+void action_reset(ActionContext *ctx) {
+  for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); ++i) {
+    if (actions[i]->reset) {
+      actions[i]->reset(actions[i]->data, ctx);
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+Arena *arena_new(void) { return calloc(1, sizeof(Arena)); }
+
+ArenaChunk *arena_chunk_new(Arena *arena, size_t size) {
+  ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+  chunk->size = size;
+  chunk->used = 0;
+  arena->allocated += sizeof(ArenaChunk) + size;
+  arena->chunks_len++;
+  return chunk;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  ArenaChunk *chunk = arena->chunks;
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  if (size > ARENA_CHUNK_SIZE / 4) {
+    /* big blocks get a chunk of their own behind the current one */
+    ArenaChunk *big = arena_chunk_new(arena, size);
+    big->used = size;
+    if (chunk) {
+      big->next = chunk->next;
+      chunk->next = big;
+    } else {
+      big->next = NULL;
+      arena->chunks = big;
+    }
+    arena->used += size;
+    return (char *)big->data;
+  }
+
+  if (!chunk || chunk->size - chunk->used < size) {
+    chunk = arena_chunk_new(arena, ARENA_CHUNK_SIZE);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+
+  void *res = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  arena->used += size;
+  return res;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+  size_t len = strlen(str) + 1;
+  return memcpy(arena_alloc(arena, len), str, len);
+}
+
+void arena_free(Arena *arena) {
+  if (!arena) {
+    return;
+  }
+
+  ArenaChunk *chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
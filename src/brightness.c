@@ -0,0 +1,268 @@
+#include "brightness.h"
+#include "idle.h"
+#include "util.h"
+#ifdef HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+#include <ctype.h>
+#include <stdlib.h>
+
+#ifdef HAVE_XRANDR
+
+typedef struct brightness_crtc {
+  RRCrtc crtc;
+  /* filled for `level`, sent as is when the level doesn't change */
+  XRRCrtcGamma *gamma;
+  /* the ramp read when the CRTC was listed, NULL if it couldn't be */
+  XRRCrtcGamma *saved;
+  /* runs since the last restore */
+  bool dimmed;
+} BrightnessCrtc;
+
+struct brightness {
+  bool supported;
+  int event_base;
+  /* a RRScreenChangeNotify came: list the CRTCs again before the next run */
+  bool stale;
+  BrightnessCrtc *crtcs;
+  size_t len;
+  double level;
+};
+
+Brightness *brightness_new(Idle *idle) {
+  Brightness *res = calloc(1, sizeof(Brightness));
+  int error_base, major = 1, minor = 2;
+
+  res->stale = true;
+  res->level = -1;
+
+  if (!XRRQueryExtension(idle->dpy, &res->event_base, &error_base) ||
+      !XRRQueryVersion(idle->dpy, &major, &minor) ||
+      (major == 1 && minor < 2)) {
+    eprintf("Your server doesn't support RandR 1.2, @brightness disabled\n");
+    return res;
+  }
+
+  for (int i = 0; i < ScreenCount(idle->dpy); ++i) {
+    XRRSelectInput(idle->dpy, RootWindow(idle->dpy, i),
+                   RRScreenChangeNotifyMask);
+  }
+  res->supported = true;
+  return res;
+}
+
+void brightness_free_crtcs(BrightnessCrtc *crtcs, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    XRRFreeGamma(crtcs[i].gamma);
+    if (crtcs[i].saved) {
+      XRRFreeGamma(crtcs[i].saved);
+    }
+  }
+  free(crtcs);
+}
+
+/*
+ * Saves the ramp of a CRTC being listed. One dimmed when the screen changed
+ * keeps the ramp saved before, the ramp it has now is a dimmed one.
+ */
+void brightness_save(BrightnessCrtc *crtc, Display *dpy, BrightnessCrtc *old,
+                     size_t old_len) {
+  for (size_t i = 0; i < old_len; ++i) {
+    if (old[i].crtc == crtc->crtc && old[i].dimmed) {
+      crtc->saved = old[i].saved;
+      crtc->dimmed = true;
+      old[i].saved = NULL;
+      return;
+    }
+  }
+
+  /* a round trip per CRTC, only when they are listed */
+  crtc->saved = XRRGetCrtcGamma(dpy, crtc->crtc);
+  crtc->dimmed = false;
+}
+
+/*
+ * The CRTCs driving an output, with the size of their gamma ramp and the ramp
+ * to restore, read once here rather than on every cycle.
+ */
+void brightness_refresh(Brightness *brightness, Idle *idle) {
+  Display *dpy = idle->dpy;
+  BrightnessCrtc *old = brightness->crtcs;
+  size_t old_len = brightness->len;
+
+  brightness->crtcs = NULL;
+  brightness->len = 0;
+  brightness->level = -1;
+  brightness->stale = false;
+
+  for (int s = 0; s < ScreenCount(dpy); ++s) {
+    XRRScreenResources *res =
+        XRRGetScreenResourcesCurrent(dpy, RootWindow(dpy, s));
+    if (!res) {
+      continue;
+    }
+
+    brightness->crtcs =
+        realloc(brightness->crtcs, (brightness->len + (size_t)res->ncrtc) *
+                                       sizeof(BrightnessCrtc));
+    for (int i = 0; i < res->ncrtc; ++i) {
+      XRRCrtcInfo *info = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
+      bool active = info && info->mode != None;
+      if (info) {
+        XRRFreeCrtcInfo(info);
+      }
+      if (!active) {
+        continue;
+      }
+
+      int size = XRRGetCrtcGammaSize(dpy, res->crtcs[i]);
+      if (size < 2) {
+        continue;
+      }
+
+      BrightnessCrtc *crtc = &brightness->crtcs[brightness->len++];
+      crtc->crtc = res->crtcs[i];
+      crtc->gamma = XRRAllocGamma(size);
+      brightness_save(crtc, dpy, old, old_len);
+    }
+    XRRFreeScreenResources(res);
+  }
+  brightness_free_crtcs(old, old_len);
+
+  dprintf("Brightness: %zu CRTCs\n", brightness->len);
+}
+
+void brightness_fill(XRRCrtcGamma *gamma, double level) {
+  for (int i = 0; i < gamma->size; ++i) {
+    double value = level * 65535.0 * i / (gamma->size - 1);
+    gamma->red[i] = gamma->green[i] = gamma->blue[i] =
+        (unsigned short)(value + 0.5);
+  }
+}
+
+void brightness_apply(Brightness *brightness, Idle *idle, double level) {
+  if (brightness->stale) {
+    brightness_refresh(brightness, idle);
+  }
+
+  for (size_t i = 0; i < brightness->len; ++i) {
+    BrightnessCrtc *crtc = &brightness->crtcs[i];
+    /* it could never be put back */
+    if (!crtc->saved) {
+      continue;
+    }
+    if (level != brightness->level) {
+      brightness_fill(crtc->gamma, level);
+    }
+    XRRSetCrtcGamma(idle->dpy, crtc->crtc, crtc->gamma);
+    crtc->dimmed = true;
+  }
+  brightness->level = level;
+  XFlush(idle->dpy);
+}
+
+/* Every dimmed CRTC gets its ramp back in a single flush, the ramp is kept */
+void brightness_restore(Brightness *brightness, Idle *idle) {
+  bool restored = false;
+
+  for (size_t i = 0; i < brightness->len; ++i) {
+    BrightnessCrtc *crtc = &brightness->crtcs[i];
+    if (crtc->dimmed) {
+      XRRSetCrtcGamma(idle->dpy, crtc->crtc, crtc->saved);
+      crtc->dimmed = false;
+      restored = true;
+    }
+  }
+
+  if (restored) {
+    XFlush(idle->dpy);
+    dprintf("Brightness restored\n");
+  }
+}
+
+void brightness_event(Brightness *brightness, XEvent *event) {
+  if (brightness->supported &&
+      event->type == brightness->event_base + RRScreenChangeNotify) {
+    XRRUpdateConfiguration(event);
+    brightness->stale = true;
+  }
+}
+
+void brightness_free(Brightness *brightness) {
+  if (!brightness) {
+    return;
+  }
+
+  brightness_free_crtcs(brightness->crtcs, brightness->len);
+  free(brightness);
+}
+
+#else
+
+void brightness_event(__attribute__((unused)) Brightness *brightness,
+                      __attribute__((unused)) XEvent *event) {}
+
+void brightness_free(__attribute__((unused)) Brightness *brightness) {}
+
+#endif
+
+bool brightness_check(__attribute__((unused)) void *data, const char *arg) {
+  char *endptr;
+  double level = strtod(arg, &endptr);
+
+  while (isspace(*endptr)) {
+    endptr++;
+  }
+  if (endptr == arg || *endptr || !(level >= 0 && level <= 1)) {
+    eprintf("'%s` is not a valid brightness, it goes from 0 to 1\n", arg);
+    return false;
+  }
+
+#ifdef HAVE_XRANDR
+  return true;
+#else
+  eprintf("@brightness needs XRandR, missing from this build\n");
+  return false;
+#endif
+}
+
+void brightness_run(__attribute__((unused)) void *data,
+                    __attribute__((unused)) const char *arg,
+                    ActionContext *ctx) {
+  Idle *idle = xsync_idle(ctx->source);
+
+  if (!idle || idle->dead) {
+    dprintf("@brightness %s: no display\n", arg);
+    return;
+  }
+
+#ifdef HAVE_XRANDR
+  if (!idle->brightness) {
+    idle->brightness = brightness_new(idle);
+  }
+  if (idle->brightness->supported) {
+    brightness_apply(idle->brightness, idle, strtod(arg, NULL));
+  }
+#endif
+}
+
+void brightness_reset(__attribute__((unused)) void *data,
+                      ActionContext *ctx) {
+  Idle *idle = xsync_idle(ctx->source);
+
+  if (!idle || idle->dead || !idle->brightness) {
+    return;
+  }
+
+#ifdef HAVE_XRANDR
+  brightness_restore(idle->brightness, idle);
+#endif
+}
+
+const Action brightness_action = {
+    .name = "brightness",
+    .data = NULL,
+    .check = brightness_check,
+    .run = brightness_run,
+    .reset = brightness_reset,
+};
@@ -0,0 +1,168 @@
+#include "command.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Bytes that mean nothing to the shell besides the blanks between words */
+#define COMMAND_PLAIN                                                          \
+  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"             \
+  "-_./:,+%@="
+#define COMMAND_BLANKS " \t"
+
+bool command_is_plain(const char *line) {
+  const char *word = line + strspn(line, COMMAND_BLANKS);
+  size_t len = strcspn(word, COMMAND_BLANKS);
+
+  /* FOO=bar cmd is an assignment */
+  if (!len || memchr(word, '=', len)) {
+    return false;
+  }
+
+  for (const char *p = line; *p; ++p) {
+    if (!strchr(COMMAND_PLAIN COMMAND_BLANKS, *p)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool command_is_executable(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+         access(path, X_OK) == 0;
+}
+
+/*
+ * Same lookup as execvp, done once. Builtins like cd or exit are not found
+ * and stay with the shell.
+ */
+char *command_search(const char *name) {
+  if (strchr(name, '/')) {
+    return command_is_executable(name) ? strdup(name) : NULL;
+  }
+
+  const char *dirs = getenv("PATH");
+  if (!dirs) {
+    dirs = "/bin:/usr/bin";
+  }
+
+  size_t name_len = strlen(name);
+  char *buf = malloc(strlen(dirs) + name_len + 2);
+  char *res = NULL;
+
+  while (!res) {
+    size_t len = strcspn(dirs, ":");
+    /* an empty entry is the current directory */
+    size_t off = len ? len : 1;
+    memcpy(buf, len ? dirs : ".", off);
+    buf[off] = '/';
+    memcpy(buf + off + 1, name, name_len + 1);
+
+    if (command_is_executable(buf)) {
+      res = buf;
+      break;
+    }
+
+    if (!dirs[len]) {
+      break;
+    }
+    dirs += len + 1;
+  }
+
+  if (!res) {
+    free(buf);
+  }
+  return res;
+}
+
+const char *command_lookup(Arena *arena, const char *name) {
+  char *path = command_search(name);
+  const char *res = path ? arena_strdup(arena, path) : NULL;
+
+  free(path);
+  return res;
+}
+
+char **command_split(Arena *arena, const char *line) {
+  char *copy = arena_strdup(arena, line);
+  size_t len = 0;
+
+  for (const char *p = copy; *(p += strspn(p, COMMAND_BLANKS));
+       p += strcspn(p, COMMAND_BLANKS)) {
+    len++;
+  }
+
+  char **argv = arena_alloc(arena, (len + 1) * sizeof(char *));
+  len = 0;
+  char *save;
+  for (char *p = strtok_r(copy, COMMAND_BLANKS, &save); p;
+       p = strtok_r(NULL, COMMAND_BLANKS, &save)) {
+    argv[len++] = p;
+  }
+  argv[len] = NULL;
+
+  return argv;
+}
+
+void command_compile(Arena *arena, Command *command, const char *line,
+                     CommandMode mode, unsigned policy) {
+  command->line = line;
+  command->argv = NULL;
+  command->path = NULL;
+  command->policy = policy;
+  command->action = action_find(line, &command->arg);
+
+  if (command->action) {
+    return;
+  }
+
+  if (mode == COMMAND_SHELL ||
+      (mode == COMMAND_AUTO && !command_is_plain(line))) {
+    return;
+  }
+
+  char **argv = command_split(arena, line);
+  if (!argv[0]) {
+    return;
+  }
+
+  const char *path = command_lookup(arena, argv[0]);
+  /*
+   * Only the shell can run a builtin, but a path that doesn't resolve is not
+   * one: it is spawned anyway so the failure is reported and counted. `,exec`
+   * never goes through the shell (command_check() rejected it if missing).
+   */
+  if (!path && mode == COMMAND_AUTO && !strchr(argv[0], '/')) {
+    dprintf("'%s` not found, running it through the shell\n", line);
+    return;
+  }
+
+  command->argv = argv;
+  command->path = path ? path : argv[0];
+}
+
+/* `,exec` forces the direct path: the program must exist */
+bool command_check(const char *line, CommandMode mode) {
+  const char *arg;
+
+  if (mode != COMMAND_EXEC || action_find(line, &arg)) {
+    return true;
+  }
+
+  const char *word = line + strspn(line, COMMAND_BLANKS);
+  size_t len = strcspn(word, COMMAND_BLANKS);
+  char *name = strndup(word, len);
+  char *path = command_search(name);
+
+  bool found = path != NULL;
+
+  if (!found) {
+    eprintf("'%s` not found, it cannot be run with ,exec\n", name);
+  }
+  free(name);
+  free(path);
+  return found;
+}
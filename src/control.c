@@ -0,0 +1,396 @@
+#include "control.h"
+#include "util.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CONTROL_BLANKS " \t\r"
+
+void on_control(Loop *, int, uint32_t, void *);
+void on_control_client(Loop *, int, uint32_t, void *);
+void on_control_expire(Loop *, int, uint32_t, void *);
+
+/*
+ * A socket still answering belongs to a running instance, anything else at
+ * the path is stale and replaced.
+ */
+bool control_bind(int fd, const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    eprintf("Control socket path too long: %s\n", path);
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe >= 0) {
+    int res = connect(probe, (struct sockaddr *)&addr, sizeof(addr));
+    close(probe);
+    if (res == 0) {
+      eprintf("%s is in use by another instance\n", path);
+      return false;
+    }
+  }
+  unlink(path);
+
+  mode_t mask = umask(0077);
+  int res = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if (res < 0 || listen(fd, 8) < 0) {
+    eprintf("Cannot listen on %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+Control *control_new(Loop *loop, const char *path, const ControlOps *ops) {
+  Control *res = calloc(1, sizeof(Control));
+  res->loop = loop;
+  res->ops = ops;
+  res->timer = -1;
+
+  res->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (res->fd < 0) {
+    eprintf("Cannot create the control socket: %s\n", strerror(errno));
+    goto err;
+  }
+
+  if (!control_bind(res->fd, path)) {
+    goto err;
+  }
+  res->path = strdup(path);
+
+  if (loop_add(loop, res->fd, EPOLLIN, on_control, res) < 0 ||
+      (res->timer = loop_timer(loop, on_control_expire, res)) < 0) {
+    goto err;
+  }
+
+  return res;
+err:
+  control_free(res);
+  return NULL;
+}
+
+inline bool control_inhibited(Control *control) {
+  return control->inhibits != NULL;
+}
+
+void control_vreply(ControlClient *client, const char *fmt, va_list args) {
+  char buf[CONTROL_LINE_MAX * 2];
+
+  if (client->dead) {
+    return;
+  }
+
+  int len = vsnprintf(buf, sizeof(buf) - 1, fmt, args);
+  if (len < 0) {
+    return;
+  }
+  len = len < (int)sizeof(buf) - 2 ? len : (int)sizeof(buf) - 2;
+  buf[len++] = '\n';
+
+  if (send(client->fd, buf, (size_t)len, MSG_DONTWAIT | MSG_NOSIGNAL) !=
+      len) {
+    dprintf("Dropping control client %d\n", client->fd);
+    client->dead = true;
+  }
+}
+
+void control_reply(ControlClient *client, const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  control_vreply(client, fmt, args);
+  va_end(args);
+}
+
+void control_notify(Control *control, const char *fmt, ...) {
+  va_list args;
+
+  for (ControlClient *client = control->clients; client;
+       client = client->next) {
+    if (client->subscribed) {
+      va_start(args, fmt);
+      control_vreply(client, fmt, args);
+      va_end(args);
+    }
+  }
+}
+
+void control_close(Control *control, ControlClient *client) {
+  loop_del(control->loop, client->fd);
+  close(client->fd);
+  free(client);
+}
+
+void control_collect(Control *control) {
+  ControlClient **p = &control->clients;
+
+  while (*p) {
+    ControlClient *client = *p;
+    if (client->dead) {
+      *p = client->next;
+      control_close(control, client);
+    } else {
+      p = &client->next;
+    }
+  }
+}
+
+void on_control(__attribute__((unused)) Loop *loop, int fd,
+                __attribute__((unused)) uint32_t events, void *data) {
+  Control *control = data;
+  int cfd;
+
+  while ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    ControlClient *client = calloc(1, sizeof(ControlClient));
+    client->fd = cfd;
+    if (loop_add(control->loop, cfd, EPOLLIN, on_control_client, control) <
+        0) {
+      close(cfd);
+      free(client);
+      continue;
+    }
+    client->next = control->clients;
+    control->clients = client;
+  }
+}
+
+/* Earliest expiry, the timer is disarmed when no inhibit expires */
+void control_arm(Control *control) {
+  uint64_t next = 0;
+
+  for (ControlInhibit *i = control->inhibits; i; i = i->next) {
+    if (i->expires && (!next || i->expires < next)) {
+      next = i->expires;
+    }
+  }
+
+  if (!next) {
+    loop_timer_arm(control->timer, 0);
+    return;
+  }
+
+  uint64_t now = monotonic_ns();
+  uint64_t ms = next > now ? (next - now + 999999) / 1000000 : 1;
+  loop_timer_arm(control->timer, ms);
+}
+
+/* Tells the sessions and the subscribers when the inhibition flips */
+void control_changed(Control *control, bool before) {
+  bool now = control_inhibited(control);
+
+  control_arm(control);
+  if (before != now) {
+    control_notify(control, now ? "event inhibited" : "event uninhibited");
+    control->ops->inhibit(now);
+  }
+}
+
+ControlInhibit **control_inhibit_find(Control *control, const char *owner) {
+  ControlInhibit **p = &control->inhibits;
+
+  while (*p && strcmp((*p)->owner, owner) != 0) {
+    p = &(*p)->next;
+  }
+  return p;
+}
+
+void control_inhibit_remove(ControlInhibit **p) {
+  ControlInhibit *inhibit = *p;
+
+  *p = inhibit->next;
+  free(inhibit->owner);
+  free(inhibit);
+}
+
+/* The last inhibit of an owner tells when all its references expire */
+void control_inhibit(Control *control, ControlClient *client,
+                     const char *owner, const char *ms) {
+  uint64_t expires = 0;
+
+  if (ms) {
+    char *endptr;
+    errno = 0;
+    unsigned long long value = strtoull(ms, &endptr, 10);
+    if (errno || endptr == ms || *endptr || !value) {
+      control_reply(client, "error invalid expiry");
+      return;
+    }
+    expires = monotonic_ns() + (uint64_t)value * 1000000;
+  }
+
+  bool before = control_inhibited(control);
+  ControlInhibit **p = control_inhibit_find(control, owner);
+  if (!*p) {
+    *p = calloc(1, sizeof(ControlInhibit));
+    (*p)->owner = strdup(owner);
+  }
+  (*p)->refs++;
+  (*p)->expires = expires;
+
+  control_reply(client, "ok %u", (*p)->refs);
+  control_changed(control, before);
+}
+
+void control_uninhibit(Control *control, ControlClient *client,
+                       const char *owner) {
+  ControlInhibit **p = control_inhibit_find(control, owner);
+
+  if (!*p) {
+    control_reply(client, "error not inhibited by %s", owner);
+    return;
+  }
+
+  unsigned refs = --(*p)->refs;
+  if (!refs) {
+    control_inhibit_remove(p);
+  }
+
+  control_reply(client, "ok %u", refs);
+  control_changed(control, true);
+}
+
+void control_query(Control *control, ControlClient *client) {
+  uint64_t now = monotonic_ns();
+
+  for (ControlInhibit *i = control->inhibits; i; i = i->next) {
+    if (i->expires) {
+      control_reply(client, "inhibit %s %u %lu", i->owner, i->refs,
+                    i->expires > now ? (i->expires - now) / 1000000 : 0);
+    } else {
+      control_reply(client, "inhibit %s %u -", i->owner, i->refs);
+    }
+  }
+  control->ops->query(client);
+  control_reply(client, "ok");
+}
+
+void control_request(Control *control, ControlClient *client, char *line) {
+  char *words[4];
+  size_t len = 0;
+  char *save = NULL;
+
+  for (char *w = strtok_r(line, CONTROL_BLANKS, &save); w && len < 4;
+       w = strtok_r(NULL, CONTROL_BLANKS, &save)) {
+    words[len++] = w;
+  }
+
+  if (!len) {
+    return;
+  }
+
+  if (strcmp(words[0], "inhibit") == 0 && (len == 2 || len == 3)) {
+    control_inhibit(control, client, words[1], len == 3 ? words[2] : NULL);
+  } else if (strcmp(words[0], "uninhibit") == 0 && len == 2) {
+    control_uninhibit(control, client, words[1]);
+  } else if (strcmp(words[0], "reset") == 0 && len == 1) {
+    control->ops->reset();
+    control_reply(client, "ok");
+  } else if (strcmp(words[0], "query") == 0 && len == 1) {
+    control_query(control, client);
+  } else if (strcmp(words[0], "subscribe") == 0 && len == 1) {
+    client->subscribed = true;
+    control_reply(client, "ok");
+  } else {
+    control_reply(client, "error invalid request");
+  }
+}
+
+void on_control_client(__attribute__((unused)) Loop *loop, int fd,
+                       __attribute__((unused)) uint32_t events, void *data) {
+  Control *control = data;
+  ControlClient *client = control->clients;
+
+  while (client && client->fd != fd) {
+    client = client->next;
+  }
+  if (!client) {
+    return;
+  }
+
+  ssize_t n = read(fd, client->buf + client->len,
+                   sizeof(client->buf) - client->len);
+  if (n <= 0) {
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      client->dead = true;
+    }
+    control_collect(control);
+    return;
+  }
+  client->len += (size_t)n;
+
+  char *start = client->buf, *end;
+  while (!client->dead &&
+         (end = memchr(start, '\n', client->len - (start - client->buf)))) {
+    *end = '\0';
+    control_request(control, client, start);
+    start = end + 1;
+  }
+
+  client->len -= (size_t)(start - client->buf);
+  memmove(client->buf, start, client->len);
+  if (client->len == sizeof(client->buf)) {
+    control_reply(client, "error request too long");
+    client->dead = true;
+  }
+
+  control_collect(control);
+}
+
+void on_control_expire(__attribute__((unused)) Loop *loop,
+                       __attribute__((unused)) int fd,
+                       __attribute__((unused)) uint32_t events, void *data) {
+  Control *control = data;
+  uint64_t now = monotonic_ns();
+  ControlInhibit **p = &control->inhibits;
+  bool before = control_inhibited(control);
+
+  while (*p) {
+    if ((*p)->expires && (*p)->expires <= now) {
+      dprintf("Inhibit of %s expired\n", (*p)->owner);
+      control_inhibit_remove(p);
+    } else {
+      p = &(*p)->next;
+    }
+  }
+
+  control_changed(control, before);
+  control_collect(control);
+}
+
+void control_free(Control *control) {
+  if (!control) {
+    return;
+  }
+
+  while (control->clients) {
+    ControlClient *client = control->clients;
+    control->clients = client->next;
+    control_close(control, client);
+  }
+  while (control->inhibits) {
+    control_inhibit_remove(&control->inhibits);
+  }
+  if (control->timer >= 0) {
+    loop_del(control->loop, control->timer);
+  }
+  if (control->fd >= 0) {
+    loop_del(control->loop, control->fd);
+    close(control->fd);
+  }
+  if (control->path) {
+    unlink(control->path);
+    free(control->path);
+  }
+  free(control);
+}
@@ -0,0 +1,350 @@
+#include "dispatch.h"
+#include "jobs.h"
+#include "launch.h"
+#include "trace.h"
+#include "util.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The main loop never launches processes itself: every Callbacks group due in
+ * a transition is pushed on a single-producer/single-consumer ring and the
+ * spawner thread does the posix_spawn calls. A push is two atomic operations
+ * and one eventfd write, whatever the number of commands in the job: every
+ * group crossed in the same transition (e.g. after a suspend) is one job.
+ * In batch mode all the commands of a job are started by a single shell, but
+ * the commands with a policy, whose instances are tracked one by one.
+ * Queued jobs hold a reference on the timeouts owning their commands, so a
+ * configuration reload can drop the old ones at any time.
+ * When the ring is full the main loop waits for room on a second eventfd,
+ * for DISPATCH_WAIT_MS at most: a job is never launched out of order from the
+ * main thread, and it is dropped (counted as failed) only if the spawner
+ * thread is stuck.
+ */
+
+typedef struct dispatch_job {
+  /* consecutive groups of the same timeouts */
+  Callbacks *callbacks;
+  size_t len;
+  /* the user came back: kill the instances that must not survive it first */
+  bool reset;
+  uint64_t since;
+  /* NULL for the environment of xs-timeout */
+  char **envp;
+} DispatchJob;
+
+static struct dispatch {
+  DispatchJob ring[DISPATCH_QUEUE_SIZE];
+  size_t head; /* written by the consumer */
+  size_t tail; /* written by the producer */
+  int efd;
+  /* written by the consumer when the producer waits for room */
+  int space_efd;
+  bool waiting;
+  bool batch;
+  bool stop;
+  bool running;
+  pthread_t thread;
+} dispatch = {.efd = -1, .space_efd = -1};
+
+/* pid from the launch: 0 when a running instance prevented it */
+static void dispatch_record(Callbacks *callbacks, uint64_t since, pid_t pid) {
+  if (pid < 0) {
+    __atomic_fetch_add(&callbacks->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (!pid) {
+    return;
+  }
+
+  __atomic_fetch_add(&callbacks->spawned, 1, __ATOMIC_RELAXED);
+  if (callbacks->latency) {
+    uint64_t now = monotonic_ns();
+    histogram_record(callbacks->latency,
+                     now > since ? (now - since) / 1000 : 0);
+  }
+}
+
+/* Launches, timed for the trace */
+static pid_t dispatch_launch(const Command *command, char **envp) {
+  uint64_t start = monotonic_ns();
+  pid_t pid = jobs_launch(command, envp);
+
+  trace_event(TRACE_SPAWN, 1, (uint64_t)(int64_t)pid, monotonic_ns() - start);
+  return pid;
+}
+
+/* One shell for the whole batch: every command starts with it */
+static void dispatch_flush(const Command **batch, Callbacks **groups, size_t n,
+                           uint64_t since, char **envp) {
+  uint64_t start = monotonic_ns();
+  pid_t pid = launch_batch(batch, n, envp);
+
+  trace_event(TRACE_SPAWN, (uint32_t)n, (uint64_t)(int64_t)pid,
+              monotonic_ns() - start);
+  for (size_t i = 0; i < n; ++i) {
+    dispatch_record(groups[i], since, pid);
+  }
+}
+
+static void dispatch_run(Callbacks *callbacks, size_t len, uint64_t since,
+                         char **envp) {
+  if (dispatch.batch) {
+    const Command *batch[DISPATCH_BATCH_MAX];
+    Callbacks *groups[DISPATCH_BATCH_MAX];
+    size_t n = 0;
+
+    for (size_t g = 0; g < len; ++g) {
+      for (size_t i = 0; i < callbacks[g].len; ++i) {
+        if (callbacks[g].cmds[i].action) {
+          continue;
+        }
+        if (callbacks[g].cmds[i].policy) {
+          dispatch_record(&callbacks[g], since,
+                          dispatch_launch(&callbacks[g].cmds[i], envp));
+          continue;
+        }
+        groups[n] = &callbacks[g];
+        batch[n++] = &callbacks[g].cmds[i];
+        if (n == DISPATCH_BATCH_MAX) {
+          dispatch_flush(batch, groups, n, since, envp);
+          n = 0;
+        }
+      }
+    }
+
+    if (n) {
+      dispatch_flush(batch, groups, n, since, envp);
+    }
+    return;
+  }
+
+  for (size_t g = 0; g < len; ++g) {
+    for (size_t i = 0; i < callbacks[g].len; ++i) {
+      if (callbacks[g].cmds[i].action) {
+        continue;
+      }
+      dispatch_record(&callbacks[g], since,
+                      dispatch_launch(&callbacks[g].cmds[i], envp));
+    }
+  }
+}
+
+static void dispatch_job(DispatchJob *job) {
+  if (job->reset) {
+    jobs_reset(job->envp);
+  }
+
+  if (job->callbacks) {
+    dispatch_run(job->callbacks, job->len, job->since, job->envp);
+    timeouts_free(job->callbacks->owner);
+  }
+}
+
+static void *dispatch_thread(__attribute__((unused)) void *arg) {
+  /*
+   * The umask of the commands, without changing the one of the main thread
+   * (e.g. for the control socket or the metrics file): the umask belongs to
+   * the file system context, shared by the threads unless unshared
+   */
+  if (unshare(CLONE_FS) < 0) {
+    eprintf("Cannot unshare the spawner thread context: %s\n",
+            strerror(errno));
+  } else {
+    umask(0);
+  }
+
+  while (1) {
+    size_t head = __atomic_load_n(&dispatch.head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&dispatch.tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+      DispatchJob *job = &dispatch.ring[head % DISPATCH_QUEUE_SIZE];
+      dispatch_job(job);
+      __atomic_store_n(&dispatch.head, ++head, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&dispatch.waiting, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(dispatch.space_efd, &one, sizeof(one)) < 0) {
+          dprintf("Cannot wake up the main thread\n");
+        }
+      }
+    }
+
+    if (__atomic_load_n(&dispatch.stop, __ATOMIC_ACQUIRE) &&
+        head == __atomic_load_n(&dispatch.tail, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+
+    uint64_t v;
+    if (read(dispatch.efd, &v, sizeof(v)) < 0) {
+      /* EINTR: just look at the queue again */
+    }
+  }
+
+  return NULL;
+}
+
+int dispatch_init(bool batch) {
+  sigset_t all, prev;
+
+  if (dispatch.running) {
+    return 0;
+  }
+
+  if ((dispatch.efd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    return -1;
+  }
+  if ((dispatch.space_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+    close(dispatch.efd);
+    dispatch.efd = -1;
+    return -1;
+  }
+
+  dispatch.head = dispatch.tail = 0;
+  dispatch.batch = batch;
+  dispatch.stop = false;
+
+  /* Signals must only ever be delivered to the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &prev);
+  int res = pthread_create(&dispatch.thread, NULL, dispatch_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+  if (res != 0) {
+    close(dispatch.efd);
+    close(dispatch.space_efd);
+    dispatch.efd = dispatch.space_efd = -1;
+    return -1;
+  }
+
+  dispatch.running = true;
+  return 0;
+}
+
+static bool dispatch_full(size_t tail) {
+  return tail - __atomic_load_n(&dispatch.head, __ATOMIC_SEQ_CST) >=
+         DISPATCH_QUEUE_SIZE;
+}
+
+/* False once DISPATCH_WAIT_MS went by without the spawner thread making room */
+static bool dispatch_wait(size_t tail) {
+  uint64_t deadline = monotonic_ns() + DISPATCH_WAIT_MS * 1000000ull;
+  bool res = true;
+
+  __atomic_store_n(&dispatch.waiting, true, __ATOMIC_SEQ_CST);
+  while (dispatch_full(tail)) {
+    uint64_t now = monotonic_ns();
+    if (now >= deadline) {
+      res = false;
+      break;
+    }
+
+    struct pollfd pfd = {dispatch.space_efd, POLLIN, 0};
+    if (poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000)) > 0) {
+      uint64_t v;
+      if (read(dispatch.space_efd, &v, sizeof(v)) < 0) {
+        /* EAGAIN: taken by an earlier wait */
+      }
+    }
+  }
+  __atomic_store_n(&dispatch.waiting, false, __ATOMIC_SEQ_CST);
+  return res;
+}
+
+/*
+ * False when the spawner thread is not running, or when the queue is full and
+ * the spawner thread didn't make room in time
+ */
+static bool dispatch_try_enqueue(DispatchJob *job) {
+  if (!dispatch.running) {
+    return false;
+  }
+
+  size_t tail = __atomic_load_n(&dispatch.tail, __ATOMIC_RELAXED);
+
+  if (dispatch_full(tail)) {
+    dprintf("Dispatch queue full, waiting for the spawner thread\n");
+    if (!dispatch_wait(tail)) {
+      return false;
+    }
+  }
+
+  dispatch.ring[tail % DISPATCH_QUEUE_SIZE] = *job;
+  __atomic_store_n(&dispatch.tail, tail + 1, __ATOMIC_RELEASE);
+
+  uint64_t one = 1;
+  if (write(dispatch.efd, &one, sizeof(one)) < 0) {
+    dprintf("Cannot wake up the spawner thread\n");
+  }
+  return true;
+}
+
+static void dispatch_enqueue(DispatchJob job) {
+  if (job.callbacks) {
+    timeouts_ref(job.callbacks->owner);
+  }
+
+  if (!dispatch_try_enqueue(&job)) {
+    eprintf("Spawner thread stuck, commands dropped\n");
+    for (size_t g = 0; g < job.len; ++g) {
+      for (size_t i = 0; i < job.callbacks[g].len; ++i) {
+        if (!job.callbacks[g].cmds[i].action) {
+          dispatch_record(&job.callbacks[g], job.since, -1);
+        }
+      }
+    }
+    if (job.callbacks) {
+      timeouts_free(job.callbacks->owner);
+    }
+  }
+}
+
+bool dispatch_push(Callbacks *callbacks, size_t len, uint64_t since,
+                   char **envp) {
+  if (!callbacks || !len) {
+    return false;
+  }
+
+  dispatch_enqueue((DispatchJob){.callbacks = callbacks,
+                                 .len = len,
+                                 .reset = false,
+                                 .since = since,
+                                 .envp = envp});
+  return true;
+}
+
+/* Queued even without reset commands, for the instances to kill */
+void dispatch_reset(Callbacks *callbacks, uint64_t since, char **envp) {
+  dispatch_enqueue((DispatchJob){.callbacks = callbacks,
+                                 .len = callbacks && callbacks->len ? 1 : 0,
+                                 .reset = true,
+                                 .since = since,
+                                 .envp = envp});
+}
+
+void dispatch_destroy(void) {
+  if (!dispatch.running) {
+    return;
+  }
+
+  __atomic_store_n(&dispatch.stop, true, __ATOMIC_RELEASE);
+  uint64_t one = 1;
+  if (write(dispatch.efd, &one, sizeof(one)) < 0) {
+    dprintf("Cannot wake up the spawner thread\n");
+  }
+  pthread_join(dispatch.thread, NULL);
+  jobs_destroy();
+
+  close(dispatch.efd);
+  close(dispatch.space_efd);
+  dispatch.efd = dispatch.space_efd = -1;
+  dispatch.running = false;
+}
@@ -0,0 +1,159 @@
+#include "dpms.h"
+#include "idle.h"
+#include "util.h"
+#include <X11/extensions/dpms.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct dpms {
+  bool supported;
+  /* DPMS enabled before the first @dpms of the cycle, to restore on reset */
+  bool saved;
+  BOOL enabled;
+};
+
+static const struct dpms_level {
+  const char *name;
+  CARD16 level;
+} dpms_levels[] = {
+    {"on", DPMSModeOn},
+    {"standby", DPMSModeStandby},
+    {"suspend", DPMSModeSuspend},
+    {"off", DPMSModeOff},
+};
+
+const struct dpms_level *dpms_level(const char *arg) {
+  size_t len = strcspn(arg, " \t");
+
+  if (arg[len + strspn(arg + len, " \t")]) {
+    return NULL;
+  }
+  for (size_t i = 0; i < sizeof(dpms_levels) / sizeof(dpms_levels[0]); ++i) {
+    if (strlen(dpms_levels[i].name) == len &&
+        strncmp(dpms_levels[i].name, arg, len) == 0) {
+      return &dpms_levels[i];
+    }
+  }
+  return NULL;
+}
+
+Dpms *dpms_new(Idle *idle) {
+  Dpms *res = calloc(1, sizeof(Dpms));
+  int event_base, error_base;
+
+  if (!DPMSQueryExtension(idle->dpy, &event_base, &error_base) ||
+      !DPMSCapable(idle->dpy)) {
+    eprintf("Your server doesn't support DPMS, @dpms disabled\n");
+    return res;
+  }
+
+  res->supported = true;
+  return res;
+}
+
+void dpms_free(Dpms *dpms) { free(dpms); }
+
+bool dpms_check(__attribute__((unused)) void *data, const char *arg) {
+  if (!dpms_level(arg)) {
+    eprintf("'%s` is not a DPMS level, use off, standby, suspend or on\n",
+            arg);
+    return false;
+  }
+  return true;
+}
+
+/* The level can only be forced with DPMS enabled */
+void dpms_run(__attribute__((unused)) void *data, const char *arg,
+              ActionContext *ctx) {
+  Idle *idle = xsync_idle(ctx->source);
+
+  if (!idle || idle->dead) {
+    dprintf("@dpms %s: no display\n", arg);
+    return;
+  }
+
+  if (!idle->dpms) {
+    idle->dpms = dpms_new(idle);
+  }
+
+  Dpms *dpms = idle->dpms;
+  if (!dpms->supported) {
+    return;
+  }
+
+  if (!dpms->saved) {
+    CARD16 level;
+    if (!DPMSInfo(idle->dpy, &level, &dpms->enabled)) {
+      return;
+    }
+    dpms->saved = true;
+  }
+
+  if (!dpms->enabled) {
+    DPMSEnable(idle->dpy);
+  }
+  DPMSForceLevel(idle->dpy, dpms_level(arg)->level);
+  XFlush(idle->dpy);
+}
+
+void dpms_reset(__attribute__((unused)) void *data, ActionContext *ctx) {
+  Idle *idle = xsync_idle(ctx->source);
+
+  if (!idle || idle->dead || !idle->dpms || !idle->dpms->saved) {
+    return;
+  }
+
+  /*
+   * The user is back: the monitors are forced on, not to the level found by
+   * the first run, which the server's own timeouts may have turned off
+   */
+  Dpms *dpms = idle->dpms;
+  dpms->saved = false;
+  DPMSForceLevel(idle->dpy, DPMSModeOn);
+  if (!dpms->enabled) {
+    DPMSDisable(idle->dpy);
+  }
+  XFlush(idle->dpy);
+  dprintf("DPMS restored\n");
+}
+
+const Action dpms_action = {
+    .name = "dpms",
+    .data = NULL,
+    .check = dpms_check,
+    .run = dpms_run,
+    .reset = dpms_reset,
+};
+
+bool screensaver_check(__attribute__((unused)) void *data, const char *arg) {
+  if (strcmp(arg, "activate") != 0 && strcmp(arg, "reset") != 0) {
+    eprintf("'%s` is not a screen saver command, use activate or reset\n",
+            arg);
+    return false;
+  }
+  return true;
+}
+
+/* Resetting the screen saver resets the idle time too: it is activity */
+void screensaver_run(__attribute__((unused)) void *data, const char *arg,
+                     ActionContext *ctx) {
+  Idle *idle = xsync_idle(ctx->source);
+
+  if (!idle || idle->dead) {
+    dprintf("@screensaver %s: no display\n", arg);
+    return;
+  }
+
+  XForceScreenSaver(idle->dpy, strcmp(arg, "activate") == 0
+                                   ? ScreenSaverActive
+                                   : ScreenSaverReset);
+  XFlush(idle->dpy);
+}
+
+const Action screensaver_action = {
+    .name = "screensaver",
+    .data = NULL,
+    .check = screensaver_check,
+    .run = screensaver_run,
+    .reset = NULL,
+};
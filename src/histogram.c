@@ -0,0 +1,89 @@
+#include "histogram.h"
+#include <stdlib.h>
+
+/*
+ * Recorded by the spawner thread and read from the main loop: every field is
+ * updated with relaxed atomics, a dump may be a few samples behind.
+ */
+
+#define SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+
+Histogram *histogram_new(void) { return calloc(1, sizeof(Histogram)); }
+
+size_t histogram_bucket(uint64_t value) {
+  if (value < SUB_COUNT) {
+    return value;
+  }
+  if (value >= (1ull << HISTOGRAM_MAX_BITS)) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+
+  unsigned magnitude = 63 - __builtin_clzll(value);
+  unsigned shift = magnitude - HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+         ((value >> shift) & (SUB_COUNT - 1));
+}
+
+uint64_t histogram_bucket_value(size_t bucket) {
+  if (bucket < SUB_COUNT) {
+    return bucket;
+  }
+
+  unsigned shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+  uint64_t sub = bucket & (SUB_COUNT - 1);
+  /* upper bound of the bucket */
+  return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void histogram_record(Histogram *histogram, uint64_t value) {
+  __atomic_fetch_add(&histogram->counts[histogram_bucket(value)], 1,
+                     __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->total, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  while (value > max &&
+         !__atomic_compare_exchange_n(&histogram->max, &max, value, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+uint64_t histogram_percentile(Histogram *histogram, double percentile) {
+  uint64_t total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+  uint64_t rank = (uint64_t)(total * percentile / 100.0 + 0.5);
+  uint64_t seen = 0;
+
+  if (!total) {
+    return 0;
+  }
+  if (!rank) {
+    rank = 1;
+  }
+
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    if (seen >= rank) {
+      uint64_t value = histogram_bucket_value(i);
+      uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+      return value < max ? value : max;
+    }
+  }
+
+  return __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+int histogram_inspect(Histogram *histogram,
+                      int (*printer)(void *, const char *, ...), void *arg) {
+  uint64_t total = __atomic_load_n(&histogram->total, __ATOMIC_RELAXED);
+  uint64_t sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+
+  return printer(arg,
+                 "n=%lu mean=%luus p50=%luus p90=%luus p99=%luus max=%luus",
+                 total, total ? sum / total : 0,
+                 histogram_percentile(histogram, 50),
+                 histogram_percentile(histogram, 90),
+                 histogram_percentile(histogram, 99),
+                 __atomic_load_n(&histogram->max, __ATOMIC_RELAXED));
+}
+
+void histogram_free(Histogram *histogram) { free(histogram); }
@@ -1,10 +1,10 @@
 #include "idle.h"
+#include "trace.h"
 #include "util.h"
 #include <X11/extensions/sync.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 
 XSyncAlarm create_monitor_alarm(Display *, XSyncCounter *);
 
@@ -17,21 +17,87 @@ int64_t XSyncValue_to_i64(XSyncValue *v) {
   return (((int64_t)v->hi) << 32) | ((int64_t)v->lo);
 }
 
+/* The counter value of a timeout, saturated: a timeout can be INT64_MAX */
+int64_t idle_wait_value(Idle *idle, int64_t timeout) {
+  if (idle->base_timer > 0 && timeout > INT64_MAX - idle->base_timer) {
+    return INT64_MAX;
+  }
+  return idle->base_timer + timeout;
+}
+
 XSyncAlarm create_zero_alarm(Display *, XSyncCounter *);
 XSyncAlarm create_timeout_alarm(Display *, XSyncCounter *);
+void idle_unregister(Idle *);
+
+/* Open displays, main thread only */
+static Idle *idle_displays = NULL;
+
+/*
+ * Round trips are counted by Xlib itself instead of at every call site: the
+ * after function runs at the end of every request, extensions included, and
+ * the request just issued has already been answered only when the call
+ * waited for its reply.
+ */
+int idle_after_request(Display *dpy) {
+  for (Idle *idle = idle_displays; idle; idle = idle->next) {
+    if (idle->dpy != dpy) {
+      continue;
+    }
+
+    unsigned long last = LastKnownRequestProcessed(dpy);
+    if (last == NextRequest(dpy) - 1 && last != idle->round_trip_serial) {
+      idle->round_trip_serial = last;
+      idle->stats.round_trips++;
+    }
+    break;
+  }
+  return 0;
+}
 
-Idle *idle_create(void) {
+void idle_unregister(Idle *idle) {
+  for (Idle **p = &idle_displays; *p; p = &(*p)->next) {
+    if (*p == idle) {
+      *p = idle->next;
+      break;
+    }
+  }
+}
+
+#ifdef HAVE_X11_IO_ERROR_EXIT
+/*
+ * Losing one display must not take the other sessions down: instead of
+ * exiting, Xlib leaves the Display in an error state and the next
+ * idle_dispatch() reports it.
+ */
+void idle_io_error_exit(Display *dpy, void *data) {
+  Idle *idle = data;
+
+  eprintf("Lost connection to %s\n", DisplayString(dpy));
+  idle->dead = true;
+}
+#endif
+
+Idle *idle_create(const char *display, const uint64_t *thresholds,
+                  size_t thresholds_len) {
   Display *dpy = NULL;
   XSyncSystemCounter *counters = NULL;
   XSyncAlarm zero_alarm = 0;
   XSyncAlarm timeout_alarm = 0;
+  IdleAlarm *alarms = NULL;
+  Idle *res = calloc(1, sizeof(Idle));
 
-  dpy = XOpenDisplay(NULL);
+  dpy = XOpenDisplay(display);
   if (dpy == NULL) {
-    eprintf("Cannot open display\n");
+    eprintf("Cannot open display %s\n", XDisplayName(display));
     goto err;
   }
 
+  /* the round trips of the setup are counted too */
+  res->dpy = dpy;
+  res->next = idle_displays;
+  idle_displays = res;
+  XSetAfterFunction(dpy, idle_after_request);
+
   int major = 1, minor = 0;
   if (!XSyncInitialize(dpy, &major, &minor)) {
     eprintf("Your server doesn't support SYNC extension\n");
@@ -95,149 +161,445 @@ Idle *idle_create(void) {
     goto err;
   }
 
-  Idle *res = malloc(sizeof(Idle));
-  res->dpy = dpy;
+  if (thresholds_len) {
+    alarms = calloc(thresholds_len, sizeof(IdleAlarm));
+    for (size_t i = 0; i < thresholds_len; ++i) {
+      alarms[i].timeout = (int64_t)thresholds[i];
+      if (!(alarms[i].alarm = create_timeout_alarm(dpy, &counter))) {
+        eprintf("Cannot create alarm\n");
+        goto err;
+      }
+    }
+  }
+
   res->event_base = event_base;
   res->error_base = error_base;
   res->base_timer = XSyncValue_to_i64(&value);
+  res->base_known = true;
   res->idle_counter = counter;
   res->idle_state = IDLE_RESET;
+  res->paused = false;
+  res->dead = false;
   res->zero_alarm = zero_alarm;
   res->timeout_alarm = timeout_alarm;
+  res->zero_serial = 0;
+  res->timeout_serial = 0;
+  res->timeout_target = 0;
+  res->target = 0;
+  res->event_time = 0;
+  res->idle_time = 0;
+  res->alarms = alarms;
+  res->alarms_len = thresholds_len;
+  res->alarms_base = 0;
+  res->reached = 0;
+  res->alarms_armed = false;
+  res->brightness = NULL;
+  res->dpms = NULL;
+  res->stats.cycle_start_round_trips = res->stats.round_trips;
+  res->stats.start_request = NextRequest(dpy);
+  res->stats.cycle_start_request = res->stats.start_request;
+#ifdef HAVE_X11_IO_ERROR_EXIT
+  XSetIOErrorExitHandler(dpy, idle_io_error_exit, res);
+#endif
   return res;
 err:
   if (dpy) {
     if (counters) {
       XSyncFreeSystemCounterList(counters);
     }
+    if (alarms) {
+      for (size_t i = 0; i < thresholds_len && alarms[i].alarm; ++i) {
+        XSyncDestroyAlarm(dpy, alarms[i].alarm);
+      }
+      free(alarms);
+    }
     if (zero_alarm) {
       XSyncDestroyAlarm(dpy, zero_alarm);
     }
     if (timeout_alarm) {
       XSyncDestroyAlarm(dpy, timeout_alarm);
     }
+    idle_unregister(res);
     XCloseDisplay(dpy);
   }
+  free(res);
   return NULL;
 }
 
 Status start_zero_alarm(Idle *);
-Status start_timeout_alarm(Idle *, uint32_t);
 Status start_timeout_alarm_i64(Idle *, int64_t);
+Status arm_threshold_alarms(Idle *);
 void disable_alarms(Idle *);
-void next_event(Display *, XEvent *);
 
+/*
+ * No request in the idle cycle waits for a reply: alarms are programmed
+ * relative to the counter when its value is unknown and the base is learned
+ * back from the alarm_value of the first notify event, while stale events are
+ * told apart by their serial instead of being discarded with XSync.
+ */
 void idle_reset(Idle *idle) {
   disable_alarms(idle);
 
-  XSyncValue value;
-  XSyncQueryCounter(idle->dpy, idle->idle_counter, &value);
-  idle->base_timer = XSyncValue_to_i64(&value);
+  idle->base_known = false;
   idle->idle_state = IDLE_RESET;
 }
 
-#define CHECK(x)                                                               \
-  if (!x) {                                                                    \
-    goto err;                                                                  \
+/*
+ * Pausing keeps the connection and the alarms, it only disarms them: resuming
+ * is a reset, the next idle_arm() programs them again.
+ */
+void idle_pause(Idle *idle) {
+  disable_alarms(idle);
+  XFlush(idle->dpy);
+  idle->paused = true;
+}
+
+void idle_resume(Idle *idle) {
+  idle->paused = false;
+  idle_reset(idle);
+}
+
+uint64_t idle_event_time(Idle *idle) { return idle->event_time; }
+
+uint64_t idle_idle_time(Idle *idle) {
+  return idle->idle_time < 0 ? 0 : (uint64_t)idle->idle_time;
+}
+
+/* Asks the server: one round trip */
+uint64_t idle_idle_after(Idle *idle) {
+  XSyncValue value;
+
+  if (!XSyncQueryCounter(idle->dpy, idle->idle_counter, &value)) {
+    return 0;
   }
 
-SelectResult wait_reset(Idle *idle, uint32_t timeout) {
-  dprintf("wait_reset(%d) with base %ld\n", timeout, idle->base_timer);
-start:
-  if (idle->base_timer > 1000) {
-    CHECK(start_zero_alarm(idle));
+  int64_t res = XSyncValue_to_i64(&value);
+  res -= idle->base_known ? idle->base_timer : 0;
+  return res < 0 ? 0 : (uint64_t)res;
+}
+
+/* The next idle_arm() waits for activity again */
+void idle_dismiss(Idle *idle) { idle->idle_state = IDLE_TIMEOUT; }
+
+/*
+ * Multi-alarm mode: replaces the threshold alarms on the same connection.
+ * Creating an alarm doesn't wait for a reply, the next idle_arm() programs
+ * the new ones.
+ */
+bool idle_set_thresholds(Idle *idle, const uint64_t *thresholds,
+                         size_t thresholds_len) {
+  if (!idle->alarms_len && !thresholds_len) {
+    return true;
   }
-  CHECK(start_timeout_alarm(idle, timeout));
 
-  while (1) {
-    XEvent event;
-    next_event(idle->dpy, &event);
+  disable_alarms(idle);
+  for (size_t i = 0; i < idle->alarms_len; ++i) {
+    XSyncDestroyAlarm(idle->dpy, idle->alarms[i].alarm);
+  }
+  free(idle->alarms);
+  idle->alarms = NULL;
+  idle->alarms_len = 0;
 
-    if (event.type == (idle->event_base + XSyncAlarmNotify)) {
-      XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)&event;
-      dprintf("Got alarm %ld (%ld, %ld)\n", ev->alarm, idle->zero_alarm,
-              idle->timeout_alarm);
+  if (!thresholds_len) {
+    return true;
+  }
 
-      if (ev->alarm == idle->zero_alarm) {
-        idle->base_timer = 0;
-        disable_alarms(idle);
-        goto start;
+  IdleAlarm *alarms = calloc(thresholds_len, sizeof(IdleAlarm));
+  for (size_t i = 0; i < thresholds_len; ++i) {
+    alarms[i].timeout = (int64_t)thresholds[i];
+    if (!(alarms[i].alarm =
+              create_timeout_alarm(idle->dpy, &idle->idle_counter))) {
+      eprintf("Cannot create alarm\n");
+      for (size_t j = 0; j < i; ++j) {
+        XSyncDestroyAlarm(idle->dpy, alarms[j].alarm);
       }
+      free(alarms);
+      return false;
+    }
+  }
 
-      if (ev->alarm == idle->timeout_alarm) {
-        disable_alarms(idle);
-        idle->idle_state = IDLE_TIMEOUT;
-        return TIMEOUT;
+  idle->alarms = alarms;
+  idle->alarms_len = thresholds_len;
+  return true;
+}
+
+IdleStats *idle_stats(Idle *idle) {
+  idle->stats.requests = NextRequest(idle->dpy) - idle->stats.start_request;
+  return &idle->stats;
+}
+
+void cycle_end(Idle *idle) {
+  IdleStats *stats = &idle->stats;
+  unsigned long request = NextRequest(idle->dpy);
+
+  stats->cycles++;
+  stats->cycle_requests = request - stats->cycle_start_request;
+  stats->cycle_round_trips =
+      stats->round_trips - stats->cycle_start_round_trips;
+  stats->cycle_start_request = request;
+  stats->cycle_start_round_trips = stats->round_trips;
+
+  dprintf("Cycle %lu: %lu requests, %lu round trips\n", stats->cycles,
+          stats->cycle_requests, stats->cycle_round_trips);
+}
+
+bool is_alarm_event(XSyncAlarmNotifyEvent *ev, XSyncAlarm alarm,
+                    unsigned long serial) {
+  /* Events generated before the alarm was (re)armed are stale */
+  return ev->alarm == alarm && ev->serial >= serial;
+}
+
+/*
+ * Local time at which the threshold was crossed (or the activity happened):
+ * the receive time minus how far the counter already was past the alarm value
+ * when the server generated the event.
+ */
+void mark_event(Idle *idle, XSyncAlarmNotifyEvent *ev, bool threshold) {
+  int64_t late = XSyncValue_to_i64(&ev->counter_value);
+  uint64_t now = monotonic_ns();
+
+  if (threshold) {
+    late -= XSyncValue_to_i64(&ev->alarm_value);
+  }
+
+  idle->event_time = late > 0 ? now - ((uint64_t)late) * 1000000 : now;
+
+  /* after a suspend it can be well past the threshold of the alarm */
+  if (threshold) {
+    idle->idle_time = XSyncValue_to_i64(&ev->counter_value) - idle->base_timer;
+  }
+}
+
+void learn_base(Idle *idle, XSyncAlarmNotifyEvent *ev, int64_t timeout) {
+  if (!idle->base_known) {
+    idle->base_timer = XSyncValue_to_i64(&ev->alarm_value) - timeout;
+    idle->base_known = true;
+    dprintf("Learned base %ld\n", idle->base_timer);
+  }
+}
+
+int idle_fd(Idle *idle) { return ConnectionNumber(idle->dpy); }
+
+#define CHECK(x)                                                               \
+  if (!x) {                                                                    \
+    goto err;                                                                  \
+  }
+
+bool arm_alarms(Idle *idle) {
+  dprintf("Arming for %ld in state %d with base %ld\n", idle->target,
+          idle->idle_state, idle->base_timer);
+
+  if (idle->alarms_len) {
+    if (!idle->alarms_armed) {
+      if (!idle->base_known || idle->base_timer > 1000 ||
+          idle->idle_state == IDLE_TIMEOUT) {
+        CHECK(start_zero_alarm(idle));
       }
+      CHECK(arm_threshold_alarms(idle));
+    }
+  } else if (idle->idle_state == IDLE_RESET) {
+    if (!idle->base_known || idle->base_timer > 1000) {
+      CHECK(start_zero_alarm(idle));
+    }
+    CHECK(start_timeout_alarm_i64(idle, idle->target));
+  } else {
+    CHECK(start_zero_alarm(idle));
+    if (idle->target) {
+      CHECK(start_timeout_alarm_i64(idle, idle->target));
     }
   }
+
+  XFlush(idle->dpy);
+  return true;
 err:
   disable_alarms(idle);
-  return ERROR;
+  return false;
+}
+
+#undef CHECK
+
+/*
+ * Arms what is needed to wait for `timeout` seconds of idleness (or just for
+ * the next activity when it's 0) from the current state. The outcome is then
+ * reported by idle_dispatch() when the connection becomes readable.
+ */
+bool idle_arm(Idle *idle, uint64_t timeout) {
+  idle->target = (int64_t)timeout;
+  if (idle->paused) {
+    return true;
+  }
+  return arm_alarms(idle);
 }
 
-SelectResult wait_timeout(Idle *idle, uint32_t timeout) {
-  dprintf("Waiting for 0");
-  CHECK(start_zero_alarm(idle));
-  if (timeout) {
-    dprintf(" or for timeout %u\n", timeout);
-    CHECK(start_timeout_alarm(idle, timeout));
+SelectResult dispatch_alarms(Idle *);
+
+/* Events selected by the actions */
+void idle_event(Idle *idle, XEvent *event) {
+  if (idle->brightness) {
+    brightness_event(idle->brightness, event);
   }
-  else {
-    dprintf("\n");
+}
+
+SelectResult idle_dispatch(Idle *idle) {
+  if (idle->alarms_len) {
+    return dispatch_alarms(idle);
   }
 
-  while (1) {
+  while (XPending(idle->dpy) > 0) {
     XEvent event;
-    next_event(idle->dpy, &event);
+    XNextEvent(idle->dpy, &event);
 
-    if (event.type == (idle->event_base + XSyncAlarmNotify)) {
-      XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)&event;
-      dprintf("Got alarm %ld (%ld, %ld)\n", ev->alarm, idle->zero_alarm,
-              idle->timeout_alarm);
+    if (event.type != (idle->event_base + XSyncAlarmNotify)) {
+      idle_event(idle, &event);
+      continue;
+    }
 
-      if (ev->alarm == idle->zero_alarm) {
-        idle->base_timer = 0;
-        disable_alarms(idle);
-        idle->idle_state = IDLE_RESET;
-        return UNIDLE;
+    XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)&event;
+    trace_event(TRACE_ALARM_FIRED, (uint32_t)ev->alarm,
+                (uint64_t)XSyncValue_to_i64(&ev->counter_value),
+                (uint64_t)XSyncValue_to_i64(&ev->alarm_value));
+    dprintf("Got alarm %ld (%ld, %ld)\n", ev->alarm, idle->zero_alarm,
+            idle->timeout_alarm);
+
+    if (is_alarm_event(ev, idle->zero_alarm, idle->zero_serial)) {
+      idle->base_timer = 0;
+      idle->base_known = true;
+      disable_alarms(idle);
+      if (idle->idle_state == IDLE_RESET) {
+        /* activity before the first timeout: wait again from 0 */
+        if (!arm_alarms(idle)) {
+          return ERROR;
+        }
+        continue;
       }
+      idle->idle_state = IDLE_RESET;
+      mark_event(idle, ev, false);
+      cycle_end(idle);
+      return UNIDLE;
+    }
 
-      if (ev->alarm == idle->timeout_alarm) {
-        disable_alarms(idle);
-        return TIMEOUT;
-      }
+    if (is_alarm_event(ev, idle->timeout_alarm, idle->timeout_serial)) {
+      learn_base(idle, ev, idle->timeout_target);
+      mark_event(idle, ev, true);
+      disable_alarms(idle);
+      idle->idle_state = IDLE_TIMEOUT;
+      return TIMEOUT;
     }
   }
 
-err:
-  disable_alarms(idle);
-  return ERROR;
+  return idle->dead ? ERROR : PENDING;
 }
 
-#undef CHECK
+/*
+ * Multi-alarm mode: every threshold alarm is armed as a group when a cycle
+ * starts, so moving from a threshold to the next one only consumes events.
+ * Alarms with a zero delta go inactive once they trigger, so only the fired
+ * ones are re-armed on reset (or all of them when the base changes).
+ */
+Status arm_threshold_alarms(Idle *idle) {
+  bool rebase = !idle->base_known || idle->alarms_base != idle->base_timer;
 
-SelectResult idle_wait(Idle *idle, uint32_t timeout) {
-  if (idle->idle_state == IDLE_RESET) {
-    return wait_reset(idle, timeout);
-  } else {
-    return wait_timeout(idle, timeout);
+  for (size_t i = 0; i < idle->alarms_len; ++i) {
+    IdleAlarm *a = &idle->alarms[i];
+    if (a->active && !rebase) {
+      continue;
+    }
+
+    XSyncAlarmAttributes attrs = {0};
+    if (idle->base_known) {
+      attrs.trigger.value_type = XSyncAbsolute;
+      i64_to_XSyncValue(idle_wait_value(idle, a->timeout),
+                        &attrs.trigger.wait_value);
+    } else {
+      attrs.trigger.value_type = XSyncRelative;
+      i64_to_XSyncValue(a->timeout, &attrs.trigger.wait_value);
+    }
+    attrs.events = 1;
+    unsigned long flags = XSyncCAValueType | XSyncCAValue | XSyncCAEvents;
+
+    a->serial = NextRequest(idle->dpy);
+    if (!XSyncChangeAlarm(idle->dpy, a->alarm, flags, &attrs)) {
+      return 0;
+    }
+    trace_event(TRACE_ALARM_ARMED, (uint32_t)a->alarm,
+                (uint64_t)XSyncValue_to_i64(&attrs.trigger.wait_value),
+                !idle->base_known);
+    a->active = true;
   }
+
+  idle->alarms_base = idle->base_known ? idle->base_timer : -1;
+  idle->reached = 0;
+  idle->alarms_armed = true;
+  XFlush(idle->dpy);
+  return 1;
 }
 
-void next_event(Display *dpy, XEvent *event) {
-  int conn = ConnectionNumber(dpy);
+SelectResult dispatch_alarms(Idle *idle) {
+  while (1) {
+    if (idle->target && idle->reached >= idle->target) {
+      idle->target = 0;
+      if (idle->idle_state == IDLE_RESET) {
+        idle->idle_state = IDLE_TIMEOUT;
+        if (!start_zero_alarm(idle)) {
+          disable_alarms(idle);
+          return ERROR;
+        }
+        XFlush(idle->dpy);
+      }
+      return TIMEOUT;
+    }
+
+    if (XPending(idle->dpy) < 1) {
+      return idle->dead ? ERROR : PENDING;
+    }
+
+    XEvent event;
+    XNextEvent(idle->dpy, &event);
 
-  while (XPending(dpy) < 1) {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(conn, &read_fds);
-    pselect(conn + 1, &read_fds, NULL, NULL, NULL, NULL);
+    if (event.type != (idle->event_base + XSyncAlarmNotify)) {
+      idle_event(idle, &event);
+      continue;
+    }
 
-    XSync(dpy, 0);
-  }
+    XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)&event;
+    trace_event(TRACE_ALARM_FIRED, (uint32_t)ev->alarm,
+                (uint64_t)XSyncValue_to_i64(&ev->counter_value),
+                (uint64_t)XSyncValue_to_i64(&ev->alarm_value));
+    dprintf("Got alarm %ld\n", ev->alarm);
+
+    if (is_alarm_event(ev, idle->zero_alarm, idle->zero_serial)) {
+      idle->base_timer = 0;
+      idle->base_known = true;
+      idle->alarms_armed = false;
+      if (idle->idle_state == IDLE_TIMEOUT) {
+        idle->idle_state = IDLE_RESET;
+        mark_event(idle, ev, false);
+        cycle_end(idle);
+        return UNIDLE;
+      }
+      if (!arm_threshold_alarms(idle)) {
+        disable_alarms(idle);
+        return ERROR;
+      }
+      continue;
+    }
 
-  XNextEvent(dpy, event);
+    for (size_t i = 0; i < idle->alarms_len; ++i) {
+      IdleAlarm *a = &idle->alarms[i];
+      if (is_alarm_event(ev, a->alarm, a->serial)) {
+        if (idle->alarms_base < 0) {
+          learn_base(idle, ev, a->timeout);
+          idle->alarms_base = idle->base_timer;
+        }
+        a->active = false;
+        if (a->timeout > idle->reached) {
+          idle->reached = a->timeout;
+          mark_event(idle, ev, true);
+        }
+        break;
+      }
+    }
+  }
 }
 
 Status start_zero_alarm(Idle *idle) {
@@ -245,23 +607,32 @@ Status start_zero_alarm(Idle *idle) {
   attrs.events = 1;
   unsigned long flags = XSyncCAEvents;
 
+  idle->zero_serial = NextRequest(idle->dpy);
+  trace_event(TRACE_ALARM_ARMED, (uint32_t)idle->zero_alarm, 0, 0);
   return XSyncChangeAlarm(idle->dpy, idle->zero_alarm, flags, &attrs);
 }
 
 Status start_timeout_alarm_i64(Idle *idle, int64_t timeout) {
   XSyncAlarmAttributes attrs = {0};
-  timeout += idle->base_timer;
-  i64_to_XSyncValue(timeout, &attrs.trigger.wait_value);
+  if (idle->base_known) {
+    attrs.trigger.value_type = XSyncAbsolute;
+    i64_to_XSyncValue(idle_wait_value(idle, timeout),
+                      &attrs.trigger.wait_value);
+  } else {
+    attrs.trigger.value_type = XSyncRelative;
+    i64_to_XSyncValue(timeout, &attrs.trigger.wait_value);
+  }
   attrs.events = 1;
-  unsigned long flags = XSyncCAValue | XSyncCAEvents;
+  unsigned long flags = XSyncCAValueType | XSyncCAValue | XSyncCAEvents;
 
+  idle->timeout_target = timeout;
+  idle->timeout_serial = NextRequest(idle->dpy);
+  trace_event(TRACE_ALARM_ARMED, (uint32_t)idle->timeout_alarm,
+              (uint64_t)XSyncValue_to_i64(&attrs.trigger.wait_value),
+              !idle->base_known);
   return XSyncChangeAlarm(idle->dpy, idle->timeout_alarm, flags, &attrs);
 }
 
-Status start_timeout_alarm(Idle *idle, uint32_t timeout) {
-  return start_timeout_alarm_i64(idle, ((int64_t)timeout) * 1000);
-}
-
 XSyncAlarm create_zero_alarm(Display *dpy, XSyncCounter *counter) {
   XSyncAlarmAttributes attrs = {0};
 
@@ -278,12 +649,17 @@ XSyncAlarm create_zero_alarm(Display *dpy, XSyncCounter *counter) {
   return XSyncCreateAlarm(dpy, flags, &attrs);
 }
 
+/*
+ * Comparison instead of transition: an alarm armed on a value the counter has
+ * already passed (e.g. a threshold added by a reload) triggers right away.
+ * With a zero delta it still goes inactive once triggered.
+ */
 XSyncAlarm create_timeout_alarm(Display *dpy, XSyncCounter *counter) {
   XSyncAlarmAttributes attrs = {0};
 
   attrs.trigger.counter = *counter;
   attrs.trigger.value_type = XSyncAbsolute;
-  attrs.trigger.test_type = XSyncPositiveTransition;
+  attrs.trigger.test_type = XSyncPositiveComparison;
   XSyncIntsToValue(&attrs.trigger.wait_value, 0, 0);
   XSyncIntsToValue(&attrs.delta, 0, 0);
   attrs.events = 0;
@@ -306,9 +682,13 @@ Status disable_alarm(Display *dpy, XSyncAlarm alarm) {
 void disable_alarms(Idle *idle) {
   disable_alarm(idle->dpy, idle->zero_alarm);
   disable_alarm(idle->dpy, idle->timeout_alarm);
-  dprintf("Started sync\n");
-  XSync(idle->dpy, 1);
-  dprintf("Stopped sync\n");
+  if (idle->alarms_armed) {
+    for (size_t i = 0; i < idle->alarms_len; ++i) {
+      disable_alarm(idle->dpy, idle->alarms[i].alarm);
+      idle->alarms[i].active = false;
+    }
+    idle->alarms_armed = false;
+  }
 }
 
 void idle_close(Idle *idle) {
@@ -319,7 +699,10 @@ void idle_close(Idle *idle) {
   if (idle->dpy) {
     // disable_alarm(idle->dpy, idle->zero_alarm);
     // disable_alarm(idle->dpy, idle->timeout_alarm);
-    disable_alarms(idle);
+    if (!idle->dead) {
+      disable_alarms(idle);
+    }
+    idle_unregister(idle);
     eprintf("closing display\n");
     XCloseDisplay(idle->dpy);
     eprintf("display closed\n");
@@ -327,9 +710,72 @@ void idle_close(Idle *idle) {
   idle->zero_alarm = 0;
   idle->timeout_alarm = 0;
   idle->dpy = NULL;
+  brightness_free(idle->brightness);
+  dpms_free(idle->dpms);
+  free(idle->alarms);
   free(idle);
 }
 
+void *xsync_create(const char *display, const uint64_t *thresholds,
+                   size_t thresholds_len) {
+  return idle_create(display, thresholds, thresholds_len);
+}
+
+int xsync_fd(void *idle) { return idle_fd(idle); }
+
+bool xsync_arm(void *idle, uint64_t timeout) { return idle_arm(idle, timeout); }
+
+SelectResult xsync_dispatch(void *idle) { return idle_dispatch(idle); }
+
+void xsync_reset(void *idle) { idle_reset(idle); }
+
+void xsync_pause(void *idle) { idle_pause(idle); }
+
+void xsync_resume(void *idle) { idle_resume(idle); }
+
+uint64_t xsync_event_time(void *idle) { return idle_event_time(idle); }
+
+uint64_t xsync_idle_time(void *idle) { return idle_idle_time(idle); }
+
+uint64_t xsync_idle_after(void *idle, __attribute__((unused)) uint32_t ms) {
+  /* called when the time has come, the counter knows */
+  return idle_idle_after(idle);
+}
+
+void xsync_dismiss(void *idle) { idle_dismiss(idle); }
+
+bool xsync_set_thresholds(void *idle, const uint64_t *thresholds,
+                          size_t thresholds_len) {
+  return idle_set_thresholds(idle, thresholds, thresholds_len);
+}
+
+IdleStats *xsync_stats(void *idle) { return idle_stats(idle); }
+
+void xsync_close(void *idle) { idle_close(idle); }
+
+/* The X connection behind a source, NULL for the other backends */
+Idle *xsync_idle(Source *source) {
+  return source && source->backend == &xsync_backend ? source->impl : NULL;
+}
+
+const SourceBackend xsync_backend = {
+    .name = "xsync",
+    .create = xsync_create,
+    .fd = xsync_fd,
+    .arm = xsync_arm,
+    .dispatch = xsync_dispatch,
+    .reset = xsync_reset,
+    .pause = xsync_pause,
+    .resume = xsync_resume,
+    .event_time = xsync_event_time,
+    .idle_time = xsync_idle_time,
+    .idle_after = xsync_idle_after,
+    .dismiss = xsync_dismiss,
+    .set_thresholds = xsync_set_thresholds,
+    .stats = xsync_stats,
+    .close = xsync_close,
+};
+
 /*
  * switch state
  * - reset   -> create alarm to next alarm and wait for the signal, destroy the
@@ -0,0 +1,128 @@
+#include "jobs.h"
+#include "launch.h"
+#include "util.h"
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static struct jobs {
+  Job *list;
+  size_t len;
+  size_t allocated;
+  pthread_mutex_t lock;
+} jobs = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+/* The pidfd becomes readable once the process has exited */
+bool job_alive(Job *job) {
+  struct pollfd pfd = {job->pidfd, POLLIN, 0};
+  return poll(&pfd, 1, 0) == 0;
+}
+
+/*
+ * The leader is not reaped before jobs_remove(), so its process group can't be
+ * another one even once it has exited: the rest of its pipeline is killed too.
+ */
+void job_kill(Job *job) {
+  dprintf("Killing '%s` (%d)\n", job->line, job->pid);
+  if (kill(-job->pid, SIGTERM) < 0) {
+    dprintf("Cannot kill %d\n", job->pid);
+  }
+  job->killed = true;
+}
+
+/* Only for the instances that have exited, the others would never be reaped */
+void jobs_remove(size_t i) {
+  waitpid(jobs.list[i].pid, NULL, __WALL);
+  close(jobs.list[i].pidfd);
+  free(jobs.list[i].line);
+  jobs.list[i] = jobs.list[--jobs.len];
+}
+
+/* Forgets the instances that have exited, killed ones included */
+void jobs_prune(void) {
+  for (size_t i = 0; i < jobs.len;) {
+    if (job_alive(&jobs.list[i])) {
+      i++;
+    } else {
+      jobs_remove(i);
+    }
+  }
+}
+
+/*
+ * Commands without a policy are just launched. The others are checked against
+ * their running instances for the same session, then tracked through the
+ * pidfd they are cloned with.
+ */
+pid_t jobs_launch(const Command *command, char **envp) {
+  if (!command->policy) {
+    return launch_command(command, envp);
+  }
+
+  pthread_mutex_lock(&jobs.lock);
+  for (size_t i = 0; i < jobs.len; ++i) {
+    Job *job = &jobs.list[i];
+    if (job->killed || job->envp != envp ||
+        strcmp(job->line, command->line) != 0) {
+      continue;
+    }
+    if ((command->policy & COMMAND_SINGLE) && job_alive(job)) {
+      dprintf("'%s` is still running\n", command->line);
+      pthread_mutex_unlock(&jobs.lock);
+      return 0;
+    }
+    if (command->policy & COMMAND_RESTART) {
+      job_kill(job);
+    }
+  }
+  jobs_prune();
+
+  int pidfd;
+  pid_t pid = launch_tracked(command, envp, &pidfd);
+  if (pidfd < 0) {
+    pthread_mutex_unlock(&jobs.lock);
+    return pid;
+  }
+
+  if (jobs.len >= jobs.allocated) {
+    jobs.allocated += 16;
+    jobs.list = realloc(jobs.list, jobs.allocated * sizeof(Job));
+  }
+  jobs.list[jobs.len++] = (Job){.line = strdup(command->line),
+                                .envp = envp,
+                                .policy = command->policy,
+                                .pid = pid,
+                                .pidfd = pidfd,
+                                .killed = false};
+  pthread_mutex_unlock(&jobs.lock);
+  return pid;
+}
+
+/* The user is back: the instances of the `kill` commands must go */
+void jobs_reset(char **envp) {
+  pthread_mutex_lock(&jobs.lock);
+  for (size_t i = 0; i < jobs.len; ++i) {
+    Job *job = &jobs.list[i];
+    if (!job->killed && job->envp == envp && (job->policy & COMMAND_KILL)) {
+      job_kill(job);
+    }
+  }
+  jobs_prune();
+  pthread_mutex_unlock(&jobs.lock);
+}
+
+/* The instances still running are left alone, for init to reap */
+void jobs_destroy(void) {
+  jobs_prune();
+  while (jobs.len) {
+    close(jobs.list[jobs.len - 1].pidfd);
+    free(jobs.list[--jobs.len].line);
+  }
+  free(jobs.list);
+  jobs.list = NULL;
+  jobs.allocated = 0;
+}
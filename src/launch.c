@@ -0,0 +1,513 @@
+#include "launch.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <features.h>
+#include <linux/sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Every command is started with a single posix_spawn (clone(CLONE_VFORK) on
+ * glibc) in a new session, with stdin closed and every descriptor above stderr
+ * closed through close_range, so the cost no longer depends on RLIMIT_NOFILE.
+ * Children are reaped by the kernel (SA_NOCLDWAIT) instead of being reparented
+ * to init through a double fork.
+ *
+ * In zygote mode a helper forked at startup, before the X connection and the
+ * spawner thread exist, receives the commands over a socketpair and forks them
+ * from its own tiny address space. Messages start with 's' followed by a shell
+ * command or with 'e' followed by the path and the argv, NUL separated.
+ *
+ * Commands with their own environment (e.g. another DISPLAY) are spawned
+ * directly, the zygote only knows its own.
+ *
+ * Commands start with umask 0. posix_spawn has no attribute for it: the
+ * spawner thread sets it on a file system context of its own (dispatch.c),
+ * the zygote and the clone3 children set it themselves.
+ *
+ * Commands with a policy are tracked through a pidfd, which must refer to the
+ * child before the kernel can reap it: they are cloned with CLONE_PIDFD instead
+ * (a fork, but those are a few commands that usually run for a long time).
+ * Their exit signal is 0, so SA_NOCLDWAIT doesn't reap them: their pid, which
+ * is also their process group, can't be reused until jobs.c waits for them.
+ * Without clone3 (before Linux 5.3, or filtered by seccomp) they are spawned
+ * like the others, untracked.
+ */
+
+extern char **environ;
+
+static posix_spawnattr_t attr;
+static posix_spawn_file_actions_t actions;
+static int initialized = 0;
+
+static struct zygote {
+  int sock;
+  pid_t pid;
+  pthread_mutex_t lock;
+} zygote = {-1, 0, PTHREAD_MUTEX_INITIALIZER};
+
+static char zygote_buf[LAUNCH_ZYGOTE_MSG_MAX + 1];
+
+/* warned once */
+static bool tracked_unsupported = false;
+
+int launch_init(void) {
+  struct sigaction sa;
+  sigset_t mask;
+
+  if (initialized) {
+    return 0;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_DFL;
+  sa.sa_flags = SA_NOCLDWAIT;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGCHLD, &sa, NULL) < 0) {
+    return -1;
+  }
+
+  if (posix_spawnattr_init(&attr) != 0) {
+    return -1;
+  }
+  if (posix_spawn_file_actions_init(&actions) != 0) {
+    posix_spawnattr_destroy(&attr);
+    return -1;
+  }
+
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGHUP);
+  posix_spawnattr_setsigdefault(&attr, &mask);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK |
+                                      POSIX_SPAWN_SETSIGDEF);
+
+  posix_spawn_file_actions_addclose(&actions, STDIN_FILENO);
+#if __GLIBC_PREREQ(2, 34)
+  posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+
+  initialized = 1;
+  return 0;
+}
+
+static pid_t zygote_launch(const struct iovec *iov, int iovcnt) {
+  struct msghdr msg;
+  ssize_t len = 0;
+  pid_t pid = -1;
+
+  for (int i = 0; i < iovcnt; ++i) {
+    len += iov[i].iov_len;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+
+  pthread_mutex_lock(&zygote.lock);
+  if (sendmsg(zygote.sock, &msg, MSG_NOSIGNAL) != len ||
+      recv(zygote.sock, &pid, sizeof(pid), 0) != sizeof(pid)) {
+    pid = -1;
+  }
+  pthread_mutex_unlock(&zygote.lock);
+
+  if (pid < 0) {
+    dprintf("Zygote cannot launch '%s`\n", (char *)iov[1].iov_base);
+  }
+  return pid;
+}
+
+/*
+ * Like execvp, a file that is not a binary and has no #! line is a script
+ * for /bin/sh: `/bin/sh path args...`
+ */
+static char **script_argv(const char *path, char *const argv[]) {
+  size_t len = 0;
+
+  while (argv[len]) {
+    len++;
+  }
+
+  char **res = malloc((len + 2) * sizeof(char *));
+  res[0] = "/bin/sh";
+  res[1] = (char *)path;
+  memcpy(res + 2, argv + 1, len * sizeof(char *));
+  return res;
+}
+
+/* Only async-signal-safe calls: it also runs in the children of clone3 */
+static void exec_argv(const char *path, char *const argv[],
+                      char *const envp[]) {
+  size_t len = 0;
+
+  execve(path, argv, envp);
+  if (errno != ENOEXEC || !argv[0]) {
+    return;
+  }
+
+  while (argv[len]) {
+    len++;
+  }
+
+  char *sh[len + 2];
+  sh[0] = "/bin/sh";
+  sh[1] = (char *)path;
+  memcpy(sh + 2, argv + 1, len * sizeof(char *));
+  execve(sh[0], sh, envp);
+}
+
+static pid_t spawn(const char *path, char *const argv[], char *const envp[]) {
+  pid_t pid;
+  int res;
+
+#if !__GLIBC_PREREQ(2, 34)
+  /* No closefrom action available: mark everything above stderr CLOEXEC */
+  syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 4 /* CLOSE_RANGE_CLOEXEC */);
+#endif
+
+  res = posix_spawn(&pid, path, &actions, &attr, argv, envp ? envp : environ);
+  if (res == ENOEXEC && argv[0]) {
+    char **sh = script_argv(path, argv);
+    res = posix_spawn(&pid, sh[0], &actions, &attr, sh, envp ? envp : environ);
+    free(sh);
+  }
+
+  if (res != 0) {
+    errno = res;
+    eprintf("Cannot spawn '%s`: %s\n", path, strerror(res));
+    return -1;
+  }
+
+  return pid;
+}
+
+pid_t launch_shell(const char *cmd, char *const *envp) {
+  char *argv[] = {"/bin/sh", "-c", (char *)cmd, NULL};
+
+  if (!initialized && launch_init() < 0) {
+    return -1;
+  }
+
+  if (zygote.sock >= 0 && !envp) {
+    size_t len = strlen(cmd);
+    if (len < LAUNCH_ZYGOTE_MSG_MAX) {
+      struct iovec iov[] = {{"s", 1}, {(char *)cmd, len}};
+      return zygote_launch(iov, 2);
+    }
+  }
+
+  return spawn(argv[0], argv, envp);
+}
+
+/* Commands with an argv skip the shell */
+pid_t launch_command(const Command *command, char *const *envp) {
+  if (!command->argv) {
+    return launch_shell(command->line, envp);
+  }
+
+  if (!initialized && launch_init() < 0) {
+    return -1;
+  }
+
+  if (zygote.sock >= 0 && !envp) {
+    struct iovec iov[LAUNCH_ZYGOTE_ARGS_MAX + 2] = {{"e", 1}};
+    size_t len = 1;
+    int n = 1;
+
+    iov[n].iov_base = (char *)command->path;
+    iov[n].iov_len = strlen(command->path) + 1;
+    len += iov[n++].iov_len;
+    for (char **arg = command->argv; *arg && n < LAUNCH_ZYGOTE_ARGS_MAX + 2;
+         ++arg) {
+      iov[n].iov_base = *arg;
+      iov[n].iov_len = strlen(*arg) + 1;
+      len += iov[n++].iov_len;
+    }
+
+    if (!command->argv[n - 2] && len <= LAUNCH_ZYGOTE_MSG_MAX) {
+      return zygote_launch(iov, n);
+    }
+  }
+
+  return spawn(command->path, command->argv, envp);
+}
+
+/*
+ * What posix_spawn does with attr and actions, in the child of clone3. The
+ * errno of a failed exec goes back through the close-on-exec status pipe.
+ */
+static void tracked_exec(const char *path, char *const argv[],
+                         char *const envp[], int status) {
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+  setsid();
+  umask(0);
+  close(STDIN_FILENO);
+  syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 4 /* CLOSE_RANGE_CLOEXEC */);
+
+  exec_argv(path, argv, envp);
+  write(status, &errno, sizeof(errno));
+  _exit(127);
+}
+
+pid_t launch_tracked(const Command *command, char *const *envp, int *pidfd) {
+  char *sh[] = {"/bin/sh", "-c", (char *)command->line, NULL};
+  const char *path = command->argv ? command->path : sh[0];
+  char *const *argv = command->argv ? command->argv : sh;
+  struct clone_args args;
+  int status[2];
+  ssize_t res;
+  int err;
+
+  *pidfd = -1;
+  if (pipe2(status, O_CLOEXEC) < 0) {
+    return -1;
+  }
+
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_PIDFD;
+  args.pidfd = (uintptr_t)pidfd;
+  args.exit_signal = 0;
+
+  pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+  if (pid == 0) {
+    tracked_exec(path, argv, envp ? envp : environ, status[1]);
+  }
+
+  if (pid < 0 && errno == ENOSYS) {
+    close(status[0]);
+    close(status[1]);
+    if (!tracked_unsupported) {
+      eprintf("clone3 is not available, command instances are not tracked\n");
+      tracked_unsupported = true;
+    }
+    return launch_command(command, envp);
+  }
+
+  close(status[1]);
+  if (pid > 0) {
+    while ((res = read(status[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+    }
+    if (res == sizeof(err)) {
+      /* not reaped by the kernel, see above */
+      waitpid(pid, NULL, __WALL);
+      close(*pidfd);
+      *pidfd = -1;
+      pid = -1;
+      errno = err;
+    }
+  }
+  close(status[0]);
+
+  if (pid < 0) {
+    eprintf("Cannot spawn '%s`: %s\n", path, strerror(errno));
+  }
+  return pid;
+}
+
+static char *quote(char *p, const char *word) {
+  *p++ = '\'';
+  for (; *word; ++word) {
+    if (*word == '\'') {
+      memcpy(p, "'\\''", 4);
+      p += 4;
+    } else {
+      *p++ = *word;
+    }
+  }
+  *p++ = '\'';
+  return p;
+}
+
+/*
+ * A batch is a small script run by a single /bin/sh (so a single zygote
+ * request in zygote mode) that starts every command in the background, in
+ * order. Commands with an argv are quoted back into words, so they still go
+ * through no expansion.
+ */
+pid_t launch_batch(const Command *const *commands, size_t len,
+                   char *const *envp) {
+  size_t size = 1;
+
+  if (len == 1) {
+    return launch_command(commands[0], envp);
+  }
+
+  for (size_t i = 0; i < len; ++i) {
+    if (!commands[i]->argv) {
+      size += strlen(commands[i]->line) + 7;
+      continue;
+    }
+    size += 4 * strlen(commands[i]->path) + 5;
+    for (char **arg = commands[i]->argv + 1; *arg; ++arg) {
+      size += 4 * strlen(*arg) + 3;
+    }
+  }
+
+  char *script = malloc(size);
+  char *p = script;
+  for (size_t i = 0; i < len; ++i) {
+    if (!commands[i]->argv) {
+      /* braces keep lists and trailing comments together */
+      p += sprintf(p, "{ %s\n} &\n", commands[i]->line);
+      continue;
+    }
+    p = quote(p, commands[i]->path);
+    for (char **arg = commands[i]->argv + 1; *arg; ++arg) {
+      *p++ = ' ';
+      p = quote(p, *arg);
+    }
+    p += sprintf(p, " &\n");
+  }
+  *p = '\0';
+
+  pid_t pid = launch_shell(script, envp);
+  free(script);
+  return pid;
+}
+
+/*
+ * The status pipe is close-on-exec: the zygote reads EOF once the command
+ * runs, or the errno of the failed execv.
+ */
+static void zygote_exec(char *msg, size_t len, int status) {
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+  signal(SIGHUP, SIG_DFL);
+  setsid();
+  umask(0);
+  close(STDIN_FILENO);
+  /* closed by the exec, the status pipe must survive until then */
+  syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 4 /* CLOSE_RANGE_CLOEXEC */);
+
+  if (msg[0] == 'e') {
+    char *argv[LAUNCH_ZYGOTE_ARGS_MAX + 1];
+    char *path = msg + 1;
+    size_t n = 0;
+
+    for (char *p = path + strlen(path) + 1; p < msg + len; p += strlen(p) + 1) {
+      argv[n++] = p;
+    }
+    argv[n] = NULL;
+    exec_argv(path, argv, environ);
+    eprintf("Cannot spawn '%s`: %s\n", path, strerror(errno));
+    write(status, &errno, sizeof(errno));
+  } else {
+    execl("/bin/sh", "/bin/sh", "-c", msg + 1, NULL);
+  }
+  _exit(127);
+}
+
+static void zygote_main(int sock) {
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+  while (1) {
+    ssize_t n = recv(sock, zygote_buf, LAUNCH_ZYGOTE_MSG_MAX, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      _exit(0);
+    }
+    zygote_buf[n] = '\0';
+
+    int status[2] = {-1, -1};
+    if (zygote_buf[0] == 'e' && pipe2(status, O_CLOEXEC) < 0) {
+      status[0] = status[1] = -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      zygote_exec(zygote_buf, n, status[1]);
+    }
+
+    if (status[0] >= 0) {
+      ssize_t res;
+      int err;
+
+      close(status[1]);
+      while ((res = read(status[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+      }
+      close(status[0]);
+      /* a missing program is a failed launch, as with posix_spawn */
+      if (pid > 0 && res == sizeof(err)) {
+        pid = -1;
+      }
+    }
+
+    if (send(sock, &pid, sizeof(pid), MSG_NOSIGNAL) < 0) {
+      _exit(0);
+    }
+  }
+}
+
+int launch_zygote_start(void) {
+  int fds[2];
+
+  if (zygote.sock >= 0) {
+    return 0;
+  }
+
+  if (!initialized && launch_init() < 0) {
+    return -1;
+  }
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    zygote_main(fds[1]);
+  }
+
+  close(fds[1]);
+  zygote.sock = fds[0];
+  zygote.pid = pid;
+  dprintf("Zygote started with pid %d\n", pid);
+  return 0;
+}
+
+void launch_destroy(void) {
+  if (zygote.sock >= 0) {
+    /* EOF makes the zygote exit */
+    close(zygote.sock);
+    zygote.sock = -1;
+    zygote.pid = 0;
+  }
+
+  if (!initialized) {
+    return;
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  initialized = 0;
+}
@@ -0,0 +1,239 @@
+#include "loop.h"
+#include "util.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/*
+ * Single threaded reactor: the X connection, a signalfd for the control
+ * signals and timerfds for local deadlines are all plain epoll sources, so
+ * nothing ever runs in signal context.
+ */
+
+#define LOOP_MAX_EVENTS 16
+
+typedef struct loop_source {
+  int fd;
+  bool owned; /* closed by the loop: signalfd and timerfds */
+  bool dead;
+  LoopCallback callback;
+  LoopSignalCallback signal_callback;
+  void *data;
+  struct loop_source *next;
+} LoopSource;
+
+struct loop {
+  int epfd;
+  int code;
+  bool running;
+  LoopSource *sources;
+  sigset_t signals;
+};
+
+Loop *loop_create(void) {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    return NULL;
+  }
+
+  Loop *loop = calloc(1, sizeof(Loop));
+  loop->epfd = epfd;
+  sigemptyset(&loop->signals);
+  return loop;
+}
+
+LoopSource *loop_source_add(Loop *loop, int fd, uint32_t events) {
+  LoopSource *source = calloc(1, sizeof(LoopSource));
+  struct epoll_event ev;
+
+  source->fd = fd;
+  ev.events = events;
+  ev.data.ptr = source;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    free(source);
+    return NULL;
+  }
+
+  source->next = loop->sources;
+  loop->sources = source;
+  return source;
+}
+
+int loop_add(Loop *loop, int fd, uint32_t events, LoopCallback callback,
+             void *data) {
+  LoopSource *source = loop_source_add(loop, fd, events);
+  if (!source) {
+    return -1;
+  }
+
+  source->callback = callback;
+  source->data = data;
+  return 0;
+}
+
+void loop_source_release(LoopSource *source) {
+  if (source->owned) {
+    close(source->fd);
+  }
+  free(source);
+}
+
+void loop_collect(Loop *loop) {
+  LoopSource **p = &loop->sources;
+
+  while (*p) {
+    LoopSource *source = *p;
+    if (source->dead) {
+      *p = source->next;
+      loop_source_release(source);
+    } else {
+      p = &source->next;
+    }
+  }
+}
+
+int loop_del(Loop *loop, int fd) {
+  for (LoopSource *source = loop->sources; source; source = source->next) {
+    if (source->fd == fd && !source->dead) {
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+      /* freed after the current batch of events */
+      source->dead = true;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int loop_signals(Loop *loop, const sigset_t *signals,
+                 LoopSignalCallback callback, void *data) {
+  if (sigprocmask(SIG_BLOCK, signals, NULL) < 0) {
+    return -1;
+  }
+
+  int fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  LoopSource *source = loop_source_add(loop, fd, EPOLLIN);
+  if (!source) {
+    close(fd);
+    return -1;
+  }
+
+  source->owned = true;
+  source->signal_callback = callback;
+  source->data = data;
+  for (int sig = 1; sig < NSIG; ++sig) {
+    if (sigismember(signals, sig) == 1) {
+      sigaddset(&loop->signals, sig);
+    }
+  }
+  return fd;
+}
+
+int loop_timer(Loop *loop, LoopCallback callback, void *data) {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  LoopSource *source = loop_source_add(loop, fd, EPOLLIN);
+  if (!source) {
+    close(fd);
+    return -1;
+  }
+
+  source->owned = true;
+  source->callback = callback;
+  source->data = data;
+  return fd;
+}
+
+int loop_timer_arm(int fd, uint64_t ms) {
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = ms / 1000;
+  its.it_value.tv_nsec = (ms % 1000) * 1000000;
+  return timerfd_settime(fd, 0, &its, NULL);
+}
+
+void loop_dispatch_signals(Loop *loop, LoopSource *source) {
+  struct signalfd_siginfo info;
+
+  while (!source->dead &&
+         read(source->fd, &info, sizeof(info)) == sizeof(info)) {
+    source->signal_callback(loop, &info, source->data);
+  }
+}
+
+void loop_dispatch(Loop *loop, LoopSource *source, uint32_t events) {
+  if (source->signal_callback) {
+    loop_dispatch_signals(loop, source);
+    return;
+  }
+
+  if (source->owned) {
+    /* timerfd: consume the expiration count */
+    uint64_t expirations;
+    if (read(source->fd, &expirations, sizeof(expirations)) < 0) {
+      return;
+    }
+  }
+
+  source->callback(loop, source->fd, events, source->data);
+}
+
+int loop_run(Loop *loop) {
+  struct epoll_event events[LOOP_MAX_EVENTS];
+
+  loop->running = true;
+  loop->code = 0;
+
+  while (loop->running) {
+    int n = epoll_wait(loop->epfd, events, LOOP_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      eprintf("epoll_wait failed: %s\n", strerror(errno));
+      return -1;
+    }
+
+    for (int i = 0; i < n && loop->running; ++i) {
+      LoopSource *source = events[i].data.ptr;
+      if (!source->dead) {
+        loop_dispatch(loop, source, events[i].events);
+      }
+    }
+
+    loop_collect(loop);
+  }
+
+  return loop->code;
+}
+
+void loop_stop(Loop *loop, int code) {
+  loop->running = false;
+  loop->code = code;
+}
+
+void loop_destroy(Loop *loop) {
+  if (!loop) {
+    return;
+  }
+
+  for (LoopSource *source = loop->sources; source; source = source->next) {
+    source->dead = true;
+  }
+  loop_collect(loop);
+  close(loop->epfd);
+  sigprocmask(SIG_UNBLOCK, &loop->signals, NULL);
+  free(loop);
+}
@@ -1,44 +1,179 @@
-#include "idle.h"
+#include "control.h"
+#include "dispatch.h"
+#include "launch.h"
+#include "loop.h"
+#include "metrics.h"
 #include "options.h"
-#include "timeouts.h"
+#include "plugin.h"
+#include "schedule.h"
+#include "source.h"
+#include "trace.h"
+#include "watch.h"
 #include "util.h"
 #include <errno.h>
-#include <setjmp.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+typedef enum reset_state {
+  RESET_NONE,
+  /* the source is paused until the activity is confirmed */
+  RESET_CONFIRMING,
+  /* too close to the last reset: it runs once the interval is over */
+  RESET_DEFERRED,
+} ResetState;
+
+/*
+ * Every display (or simulation script) is a session with its own idle source
+ * and its own position in the shared schedule.
+ */
+typedef struct session {
+  const SourceBackend *backend;
+  /* display name or script, NULL for $DISPLAY */
+  const char *name;
+  /* environment of the commands, NULL to inherit ours */
+  char **envp;
+  Source *source;
+  /* index of the next threshold in the schedule */
+  size_t cursor;
+  bool finished;
+  bool failed;
+  /* reset debounce, -1 when disabled */
+  int reset_timer;
+  ResetState reset_state;
+  /* cursor before the activity being confirmed, and when it happened */
+  size_t reset_cursor;
+  uint64_t reset_since;
+  uint64_t last_reset;
+  uint64_t resets_suppressed;
+  uint64_t spawns_suppressed;
+  /* for the metrics, X traffic of the connections already closed */
+  uint64_t transitions[METRICS_STATES];
+  uint64_t requests;
+  uint64_t round_trips;
+  uint64_t reconnects;
+} Session;
 
 struct state {
-  uint32_t prev_timeout;
-  uint32_t last_timeout;
-  Timeouts *timeouts;
-  Idle *idle;
-  bool restart;
+  Schedule *schedule;
+  Session *sessions;
+  size_t sessions_len;
+  Loop *loop;
+  bool multi_alarm;
+  const uint64_t *alarms;
+  size_t alarms_len;
+  /* ms, 0 to disable */
+  uint32_t reset_activity;
+  uint32_t reset_interval;
+  /* config file reload */
+  const char *config;
+  char **args;
+  size_t args_len;
+  Watch *watch;
+  int reload_timer;
+  /* the file is parsed by a thread, the result is handed back on reload_efd */
+  int reload_efd;
+  bool reloading;
+  /* changed again while it was being parsed */
+  bool reload_again;
+  Timeouts *reloaded;
+  Control *control;
+  /* Prometheus textfile, written periodically */
+  const char *metrics;
+  int metrics_timer;
 } state = {
-    0, 0, NULL, NULL, false,
+    NULL, NULL, 0, NULL, false, NULL, 0, 0, 0, NULL, NULL, 0, NULL, -1, -1,
+    false, false, NULL, NULL, NULL, -1,
 };
 
-sigjmp_buf startbuf;
+/* parses the configuration file while state.reloading */
+static pthread_t reload_thread;
+
+extern char **environ;
 
-void set_handler(int, void (*)(int));
-void sigalrm_handler(int);
-void sigcont_handler(int);
-void sigtstp_handler(int);
-void sigstop_handler(int);
+void on_signal(Loop *, struct signalfd_siginfo *, void *);
+void on_idle(Loop *, int, uint32_t, void *);
+void on_watch(Loop *, int, uint32_t, void *);
+void on_reload(Loop *, int, uint32_t, void *);
+void on_reloaded(Loop *, int, uint32_t, void *);
+void on_reset(Loop *, int, uint32_t, void *);
+void on_metrics(Loop *, int, uint32_t, void *);
+void state_sessions(Options *);
+const char *session_name(Session *);
+const char *session_status(Session *);
+char **session_environ(const char *);
+bool state_watch();
+void state_load();
+void state_reload(Timeouts *);
+bool state_connect();
+void state_reconnect();
+void state_check();
 void state_destroy();
-void state_reset();
-void state_timeout();
-void state_step();
+void state_suspend();
+void state_dump();
+void state_metrics();
+void state_restart();
+void state_inhibit(bool);
+bool state_inhibited();
+void state_query(ControlClient *);
+bool session_connect(Session *);
+void session_disconnect(Session *);
+void session_reconnect(Session *);
+void session_fail(Session *);
+void session_reset(Session *, uint64_t);
+bool session_unidle(Session *, uint64_t);
+void session_reset_limited(Session *, uint64_t);
+void session_suppress(Session *);
+void session_restart(Session *);
+void session_timeout(Session *);
+bool session_wait(Session *);
+void session_process(Session *);
+
+const ControlOps control_ops = {
+    .inhibit = state_inhibit,
+    .reset = state_restart,
+    .query = state_query,
+};
 
 #define VERSION "0.0.1"
 
+/* ms to wait after the last change of the config file */
+#define CONFIG_RELOAD_DELAY 100
+
+/* ms between two writes of the metrics */
+#define METRICS_INTERVAL 15000
+
 #define SHORT_HELP                                                             \
-  "xs-timeout [-h|-v|[<seconds>:<command>]+ [reset:<command>]*]"
+  "xs-timeout [-h|-v|[-zmb] [-a <ms>] [-i <ms>] [-d <display>]* "           \
+  "[-s <script>]* [-c <file>] [-p <plugin>]* [-C <socket>] [-t <file>] "     \
+  "[-M <file>] [<seconds>:<command>]* [reset:<command>]*]"
 
 #define HELP                                                                   \
   "xs-timeout v" VERSION "\n"                                                  \
   "\n"                                                                         \
-  "USAGE: " SHORT_HELP
+  "USAGE: " SHORT_HELP "\n"                                                    \
+  "\n"                                                                         \
+  "OPTIONS:\n"                                                                 \
+  "  -z, --zygote       launch commands from a pre-forked helper process\n"    \
+  "  -m, --multi-alarm  program one alarm per threshold up front\n"            \
+  "  -b, --batch        start the commands due together from a single shell\n" \
+  "  -a, --reset-activity <ms>\n"                                              \
+  "                     run the resets only after this much activity\n"      \
+  "  -i, --reset-interval <ms>\n"                                              \
+  "                     run the resets at most once in this interval\n"      \
+  "  -d, --display      watch this display (repeatable, default $DISPLAY)\n"   \
+  "  -s, --simulate     replay idle activity from a script (repeatable)\n"    \
+  "  -c, --config       read the timeouts from a file, reloaded on change\n"  \
+  "  -p, --plugin       load the actions of a shared object (repeatable)\n"   \
+  "  -C, --control      serve inhibits and state queries on a unix socket\n"  \
+  "  -t, --trace        record the trace ring in this file\n"                  \
+  "                     (default $XDG_RUNTIME_DIR/xs-timeout.trace)\n"         \
+  "  -M, --metrics      write Prometheus metrics to this textfile"
 
 int main(int argc, char **argv) {
   int code = 0;
@@ -54,6 +189,12 @@ int main(int argc, char **argv) {
     goto end;
   }
 
+  if (opts.error) {
+    eprintf(SHORT_HELP "\n");
+    code = 1;
+    goto end;
+  }
+
   if (!opts.timeouts) {
     eprintf("No timeouts found.\n\n");
     eprintf(SHORT_HELP "\n");
@@ -67,136 +208,893 @@ int main(int argc, char **argv) {
   fputs("\n", stderr);
 #endif
 
-  state.idle = idle_create();
-  if (!state.idle) {
-    /* Errors already printed */
+  if (launch_init() < 0) {
+    eprintf("Cannot initialize the launcher\n");
     code = 1;
     goto end;
   }
 
-  state.timeouts = opts.timeouts;
+  if (opts.zygote && launch_zygote_start() < 0) {
+    eprintf("Cannot start the zygote\n");
+    code = 1;
+    goto end;
+  }
+
+  /* before the spawner thread, which records the launches */
+  char *trace = opts.trace ? NULL : trace_path();
+  trace_open(opts.trace ? opts.trace : trace);
+  free(trace);
+
+  if (dispatch_init(opts.batch) < 0) {
+    eprintf("Cannot start the spawner thread\n");
+    code = 1;
+    goto end;
+  }
+
+  state.schedule = schedule_compile(opts.timeouts);
   opts.timeouts = NULL;
 
-  if (sigsetjmp(startbuf, 1) == 0) {
-    dprintf("Starting\n");
-    set_handler(SIGALRM, &sigalrm_handler);
-    set_handler(SIGTSTP, &sigtstp_handler);
-    set_handler(SIGSTOP, &sigstop_handler);
-    set_handler(SIGCONT, &sigcont_handler);
+  state.config = opts.config;
+  state.args = opts.args;
+  state.args_len = opts.args_len;
+
+  state.reset_activity = opts.reset_activity;
+  state.reset_interval = opts.reset_interval;
+  state.multi_alarm = opts.multi_alarm;
+  if (state.multi_alarm) {
+    state.alarms = state.schedule->thresholds;
+    state.alarms_len = state.schedule->len;
   }
-  else {
-    dprintf("Restarting\n");
+
+  state_sessions(&opts);
+
+  if (!(state.loop = loop_create())) {
+    eprintf("Cannot create the event loop\n");
+    code = 1;
+    goto end;
   }
 
-  state.last_timeout = 0;
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGALRM);
+  sigaddset(&signals, SIGTSTP);
+  sigaddset(&signals, SIGCONT);
+  sigaddset(&signals, SIGHUP);
+  sigaddset(&signals, SIGUSR1);
+  if (loop_signals(state.loop, &signals, on_signal, NULL) < 0) {
+    eprintf("Cannot handle signals\n");
+    code = 1;
+    goto end;
+  }
 
-  while (1) {
-    if (state.restart) {
-      state_reset();
-      dprintf("RESET RESTART\n");
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    if ((state.reset_activity || state.reset_interval) &&
+        (session->reset_timer =
+             loop_timer(state.loop, on_reset, session)) < 0) {
+      eprintf("Cannot create the reset timer\n");
+      code = 1;
+      goto end;
     }
+  }
 
-    state_step();
-    switch (idle_wait(state.idle, state.last_timeout)) {
-    case ERROR:
-      goto end;
-    case TIMEOUT:
-      state_timeout();
-      dprintf("TIMEOUT\n");
-      break;
-    case UNIDLE:
-      state_reset();
-      break;
+  if (opts.control &&
+      !(state.control = control_new(state.loop, opts.control, &control_ops))) {
+    code = 1;
+    goto end;
+  }
+
+  state.metrics = opts.metrics;
+  if (state.metrics &&
+      ((state.metrics_timer = loop_timer(state.loop, on_metrics, NULL)) < 0 ||
+       loop_timer_arm(state.metrics_timer, METRICS_INTERVAL) < 0 ||
+       metrics_start() < 0)) {
+    eprintf("Cannot start writing the metrics\n");
+    code = 1;
+    goto end;
+  }
+
+  if (state.config && !state_watch()) {
+    eprintf("Cannot watch the config file\n");
+    code = 1;
+    goto end;
+  }
+
+  if (!state_connect()) {
+    /* Errors already printed */
+    code = 1;
+    goto end;
+  }
+
+  dprintf("Starting\n");
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    session->cursor = 0;
+    if (session_wait(session)) {
+      session_process(session);
     }
   }
 
+  if (loop_run(state.loop) != 0) {
+    code = 1;
+  }
+
+  if (code == 0) {
+    /* every simulation is over: let the queued commands run and report */
+    dispatch_destroy();
+    state_metrics();
+    metrics_stop();
+    state_dump();
+  }
+
 end:
   if (opts.timeouts) {
     timeouts_free(opts.timeouts);
   }
   state_destroy();
+  plugin_destroy();
+  trace_close();
+  free(opts.args);
+  free(opts.displays);
+  free(opts.simulate);
   return code;
 }
 
-void state_timeout() {
-  if (state.last_timeout != 0) {
-    timeouts_exec(state.timeouts, state.prev_timeout, state.last_timeout);
+/* Commands of a session run with its display as DISPLAY */
+char **session_environ(const char *display) {
+  size_t len = 0;
+  while (environ[len]) {
+    len++;
+  }
+
+  char **res = malloc((len + 2) * sizeof(char *));
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (strncmp(environ[i], "DISPLAY=", 8) != 0) {
+      res[n++] = environ[i];
+    }
+  }
+
+  char *var = malloc(strlen(display) + 9);
+  strcpy(var, "DISPLAY=");
+  strcat(var, display);
+  res[n++] = var;
+  res[n] = NULL;
+  return res;
+}
+
+const char *session_name(Session *session) {
+  return session->name ? session->name : "$DISPLAY";
+}
+
+void state_sessions(Options *opts) {
+  size_t len = opts->displays_len + opts->simulate_len;
+
+  state.sessions = calloc(len ? len : 1, sizeof(Session));
+  for (size_t i = 0; i < opts->displays_len; ++i) {
+    Session *session = &state.sessions[state.sessions_len++];
+    session->backend = &xsync_backend;
+    session->name = opts->displays[i];
+    /* with a single display the commands simply inherit our environment */
+    if (opts->displays_len + opts->simulate_len > 1) {
+      session->envp = session_environ(opts->displays[i]);
+    }
+  }
+
+  for (size_t i = 0; i < opts->simulate_len; ++i) {
+    Session *session = &state.sessions[state.sessions_len++];
+    session->backend = &sim_backend;
+    session->name = opts->simulate[i];
+  }
+
+  if (!state.sessions_len) {
+    state.sessions[state.sessions_len++].backend = &xsync_backend;
+  }
+
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    state.sessions[i].reset_timer = -1;
   }
 }
 
-void state_reset() {
-  timeouts_exec_reset(state.timeouts);
+/*
+ * After a suspend or a late alarm several thresholds can be behind: they are
+ * all executed in the same transition.
+ */
+void session_timeout(Session *session) {
+  if (session->reset_state == RESET_DEFERRED) {
+    /* idle again before the reset could run: it would only be undone */
+    session->reset_state = RESET_NONE;
+    session_suppress(session);
+  }
+
+  if (session->cursor >= state.schedule->len) {
+    return;
+  }
+
+  uint64_t idle = source_idle_time(session->source);
+  size_t to = schedule_advance(state.schedule, session->cursor, idle);
+  to = to > session->cursor ? to : session->cursor + 1;
+  schedule_exec(state.schedule, session->cursor, to,
+                source_event_time(session->source), session->envp,
+                session->source);
+  session->cursor = to;
+
+  if (state.control) {
+    control_notify(state.control, "event timeout %s %lu",
+                   session_name(session),
+                   schedule_threshold(state.schedule, to - 1));
+  }
+}
+
+void session_reset(Session *session, uint64_t since) {
+  schedule_exec_reset(state.schedule, since, session->envp, session->source);
   dprintf("RESET UNIDLE\n");
-  state.prev_timeout = 0;
-  state.last_timeout = 0;
-  state.restart = false;
+  session->cursor = 0;
+  session->reset_state = RESET_NONE;
+  session->last_reset = monotonic_ns();
+
+  if (state.control) {
+    control_notify(state.control, "event reset %s", session_name(session));
+  }
 }
 
-void state_step() {
-  state.prev_timeout = state.last_timeout;
-  state.last_timeout = timeouts_next(state.timeouts, state.last_timeout);
+void session_suppress(Session *session) {
+  dprintf("RESET SUPPRESSED\n");
+  session->resets_suppressed++;
+  if (state.schedule->reset) {
+    session->spawns_suppressed += state.schedule->reset->len;
+  }
 }
 
-void state_destroy() {
-  if (state.idle) {
-    idle_close(state.idle);
+/*
+ * Debounce of the activity, so that a jittery mouse doesn't make the timeouts
+ * and the resets fire back and forth. With --reset-activity the source is
+ * paused until the user is seen active again that much later, otherwise the
+ * activity is dismissed and the cycle goes on where it was. Returns false
+ * while the activity is being confirmed.
+ */
+bool session_unidle(Session *session, uint64_t since) {
+  if (!state.reset_activity) {
+    session_reset_limited(session, since);
+    return true;
   }
-  if (state.timeouts) {
-    timeouts_free(state.timeouts);
+
+  session->reset_state = RESET_CONFIRMING;
+  session->reset_cursor = session->cursor;
+  session->reset_since = since;
+  source_pause(session->source);
+  loop_timer_arm(session->reset_timer, state.reset_activity);
+  return false;
+}
+
+/*
+ * With --reset-interval the resets too close to the previous one are
+ * deferred to the end of the interval, and dropped if the user goes idle
+ * again before.
+ */
+void session_reset_limited(Session *session, uint64_t since) {
+  uint64_t interval = (uint64_t)state.reset_interval * 1000000;
+  uint64_t elapsed = monotonic_ns() - session->last_reset;
+
+  if (!session->last_reset || elapsed >= interval) {
+    session_reset(session, since);
+    return;
   }
+
+  session->cursor = 0;
+  session->reset_state = RESET_DEFERRED;
+  session->reset_since = since;
+  loop_timer_arm(session->reset_timer, (interval - elapsed + 999999) / 1000000);
 }
 
-void set_handler(int signal, void (*handler)(int)) {
-  struct sigaction sa;
-  sa.sa_flags = SA_ONSTACK | SA_NODEFER;
-  sa.sa_handler = handler;
-  sigaction(signal, &sa, NULL);
+bool session_wait(Session *session) {
+  if (!source_arm(session->source,
+                  schedule_threshold(state.schedule, session->cursor))) {
+    session_fail(session);
+    return false;
+  }
+  return true;
 }
 
-void sigstop_handler(__attribute__((unused)) int sig) {
-  dprintf("Stopping\n");
+void session_process(Session *session) {
+  while (session->source) {
+    SelectResult res = source_dispatch(session->source);
+    if (res != PENDING) {
+      session->transitions[res]++;
+      trace_event(TRACE_STATE, res, (uint64_t)(session - state.sessions),
+                  session->cursor);
+    }
 
-  idle_close(state.idle);
-  state.idle = NULL;
+    switch (res) {
+    case PENDING:
+      return;
+    case ERROR:
+      session_fail(session);
+      return;
+    case FINISHED:
+      /* the source stays open for its stats */
+      session->finished = true;
+      state_check();
+      return;
+    case TIMEOUT:
+      session_timeout(session);
+      dprintf("TIMEOUT\n");
+      break;
+    case UNIDLE:
+      if (!session_unidle(session, source_event_time(session->source))) {
+        return;
+      }
+      break;
+    }
 
-  dprintf("Stopped\n");
+    if (!session_wait(session)) {
+      return;
+    }
+  }
 }
 
-void sigtstp_handler(__attribute__((unused)) int sig) {
-  sigset_t tstp_mask, prev_mask;
-  int savedErrno = errno;
+void session_restart(Session *session) {
+  if (session->reset_state == RESET_CONFIRMING) {
+    source_resume(session->source);
+  }
+  session_reset(session, monotonic_ns());
+  dprintf("RESET RESTART\n");
+  if (session_wait(session)) {
+    session_process(session);
+  }
+}
 
-  sigstop_handler(SIGSTOP);
+bool state_watch() {
+  if (!(state.watch = watch_new(state.config))) {
+    return false;
+  }
 
-  signal(SIGTSTP, SIG_DFL);
+  if (loop_add(state.loop, watch_fd(state.watch), EPOLLIN, on_watch, NULL) <
+      0) {
+    return false;
+  }
 
-  raise(SIGTSTP);
+  if ((state.reload_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ||
+      loop_add(state.loop, state.reload_efd, EPOLLIN, on_reloaded, NULL) < 0) {
+    return false;
+  }
+
+  return (state.reload_timer = loop_timer(state.loop, on_reload, NULL)) >= 0;
+}
+
+void *state_load_thread(__attribute__((unused)) void *arg) {
+  Timeouts *timeouts = load_timeouts(state.config, state.args, state.args_len);
+  uint64_t one = 1;
+
+  __atomic_store_n(&state.reloaded, timeouts, __ATOMIC_RELEASE);
+  if (write(state.reload_efd, &one, sizeof(one)) < 0) {
+    eprintf("Cannot hand the configuration back: %s\n", strerror(errno));
+  }
+  return NULL;
+}
+
+/*
+ * The file is read and its commands looked up in PATH by a thread: a large
+ * configuration takes milliseconds, during which the loop keeps serving the
+ * idle events. A change made meanwhile is parsed again once it is done.
+ */
+void state_load() {
+  sigset_t all, prev;
+
+  if (state.reloading) {
+    state.reload_again = true;
+    return;
+  }
+
+  /* Signals must only ever be delivered to the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &prev);
+  int res =
+      pthread_create(&reload_thread, NULL, state_load_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+  if (res != 0) {
+    dprintf("Cannot start the reload thread, parsing inline\n");
+    state_reload(load_timeouts(state.config, state.args, state.args_len));
+    return;
+  }
+  state.reloading = true;
+}
+
+/*
+ * Swaps in a freshly parsed schedule between two idle events, keeping the
+ * connections and the position of every session in its idle cycle: the
+ * thresholds already reached are not executed again.
+ */
+void state_reload(Timeouts *timeouts) {
+  if (!timeouts) {
+    eprintf("Keeping the current configuration\n");
+    return;
+  }
+
+#ifdef DEBUG
+  timeouts_inspect(timeouts, (int (*)(void *, const char *, ...))fprintf,
+                   stderr);
+  fputs("\n", stderr);
+#endif
 
-  sigemptyset(&tstp_mask);
-  sigaddset(&tstp_mask, SIGTSTP);
-  sigprocmask(SIG_UNBLOCK, &tstp_mask, &prev_mask);
+  Schedule *schedule = schedule_compile(timeouts);
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    session->cursor = schedule_remap(state.schedule, schedule, session->cursor);
+    session->reset_cursor =
+        schedule_remap(state.schedule, schedule, session->reset_cursor);
+  }
 
-  sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+  /* queued commands keep their own reference on the old timeouts */
+  schedule_free(state.schedule);
+  state.schedule = schedule;
+  dprintf("Reloaded\n");
 
-  set_handler(SIGTSTP, &sigtstp_handler);
+  if (state.multi_alarm) {
+    state.alarms = schedule->thresholds;
+    state.alarms_len = schedule->len;
+  }
+
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    if (!session->source || session->finished) {
+      continue;
+    }
 
-  errno = savedErrno;
+    if (state.multi_alarm && !source_set_thresholds(session->source,
+                                                    state.alarms,
+                                                    state.alarms_len)) {
+      session_reconnect(session);
+      continue;
+    }
+
+    if (session_wait(session)) {
+      session_process(session);
+    }
+  }
 }
 
-void sigcont_handler(__attribute__((unused)) int sig) {
-  dprintf("Resuming\n");
-  if (!(state.idle = idle_create())) {
+bool session_connect(Session *session) {
+  if (!(session->source = source_create(session->backend, session->name,
+                                        state.alarms, state.alarms_len))) {
+    return false;
+  }
+
+  if (loop_add(state.loop, source_fd(session->source), EPOLLIN, on_idle,
+               session) < 0) {
+    source_close(session->source);
+    session->source = NULL;
+    return false;
+  }
+
+  /* a reconnection doesn't end an inhibition */
+  if (state_inhibited()) {
+    source_pause(session->source);
+  }
+
+  session->failed = false;
+  return true;
+}
+
+/* Every session must connect at startup */
+bool state_connect() {
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    if (!session_connect(&state.sessions[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void session_disconnect(Session *session) {
+  if (session->source) {
+    IdleStats *stats = source_stats(session->source);
+    session->requests += stats->requests;
+    session->round_trips += stats->round_trips;
+    loop_del(state.loop, source_fd(session->source));
+    source_close(session->source);
+    session->source = NULL;
+  }
+}
+
+/*
+ * A broken session is dropped while the others keep running, until SIGHUP
+ * tries to connect it again.
+ */
+void session_fail(Session *session) {
+  eprintf("Dropping session %s\n", session_name(session));
+  session->failed = true;
+  session_disconnect(session);
+  state_check();
+}
+
+void session_reconnect(Session *session) {
+  dprintf("Reconnecting\n");
+  session->reconnects++;
+  session_disconnect(session);
+  if (!session_connect(session)) {
     eprintf("Cannot reestabilish connection\n");
-    state_destroy();
-    exit(1);
+    session_fail(session);
+    return;
+  }
+  session_restart(session);
+}
+
+void state_reconnect() {
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    if (!state.sessions[i].finished) {
+      session_reconnect(&state.sessions[i]);
+    }
+  }
+}
+
+/* Stops once no session is left: with 0 only if all of them finished */
+void state_check() {
+  bool failed = false;
+
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    if (!session->finished && !session->failed) {
+      return;
+    }
+    failed = failed || session->failed;
+  }
+
+  loop_stop(state.loop, failed ? 1 : 0);
+}
+
+void state_suspend() {
+  sigset_t mask;
+
+  dprintf("Stopping\n");
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    if (state.sessions[i].source) {
+      source_pause(state.sessions[i].source);
+    }
+  }
+  dprintf("Stopped\n");
+
+  /* SIGTSTP is blocked for the signalfd: stop with the default action */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTSTP);
+  raise(SIGTSTP);
+  sigprocmask(SIG_UNBLOCK, &mask, NULL);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+}
+
+void state_dump() {
+  int (*printer)(void *, const char *, ...) =
+      (int (*)(void *, const char *, ...))fprintf;
+
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    if (!session->source) {
+      continue;
+    }
+
+    IdleStats *stats = source_stats(session->source);
+    if (state.sessions_len > 1) {
+      eprintf("%s: ", session_name(session));
+    }
+    eprintf("cycles: %lu, requests: %lu (last cycle %lu), round trips: %lu "
+            "(last cycle %lu)\n",
+            stats->cycles, stats->requests, stats->cycle_requests,
+            stats->round_trips, stats->cycle_round_trips);
+    if (session->reset_timer >= 0) {
+      eprintf("resets suppressed: %lu (%lu spawns)\n",
+              session->resets_suppressed, session->spawns_suppressed);
+    }
+  }
+  eprintf("config: %zu bytes\n", timeouts_footprint(state.schedule->timeouts));
+  schedule_inspect_latency(state.schedule, printer, stderr);
+}
+
+/*
+ * Only a snapshot is taken here: the file is written by the metrics thread.
+ * The idle time is extrapolated from the last event of the source, since
+ * asking the server would cost a round trip: from the last timeout while idle,
+ * from the last activity reported otherwise.
+ */
+void state_metrics() {
+  if (!state.metrics) {
+    return;
+  }
+
+  Metrics *metrics = metrics_new(state.metrics, state.schedule->timeouts,
+                                 state.sessions_len);
+  uint64_t now = monotonic_ns();
+
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    MetricsSession *m = &metrics->sessions[i];
+
+    m->name = strdup(session_name(session));
+    memcpy(m->transitions, session->transitions, sizeof(m->transitions));
+    m->requests = session->requests;
+    m->round_trips = session->round_trips;
+    m->reconnects = session->reconnects;
+    if (!session->source) {
+      continue;
+    }
+
+    IdleStats *stats = source_stats(session->source);
+    m->requests += stats->requests;
+    m->round_trips += stats->round_trips;
+    uint64_t since = source_event_time(session->source);
+    uint64_t elapsed = since && now > since ? (now - since) / 1000000 : 0;
+    if (session->cursor) {
+      m->idle = source_idle_time(session->source) + elapsed;
+      m->threshold = schedule_threshold(state.schedule, session->cursor - 1);
+    } else {
+      /*
+       * Activity after the last one reported is not seen until the next
+       * cycle: an upper bound, below the first threshold or it would be idle
+       */
+      uint64_t first = schedule_threshold(state.schedule, 0);
+      m->idle = elapsed < first ? elapsed : first;
+    }
+  }
+
+  if (!metrics_post(metrics)) {
+    dprintf("Metrics thread busy, previous snapshot skipped\n");
   }
-  state.restart = true;
-  siglongjmp(startbuf, 1);
 }
 
-void sigalrm_handler(__attribute__((unused)) int sig) {
+void state_destroy() {
+  dispatch_destroy();
+  metrics_stop();
+  control_free(state.control);
+  state.control = NULL;
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    session_disconnect(session);
+    if (session->envp) {
+      /* only DISPLAY is ours, the rest belongs to environ */
+      for (char **var = session->envp; *var; ++var) {
+        if (strncmp(*var, "DISPLAY=", 8) == 0) {
+          free(*var);
+        }
+      }
+      free(session->envp);
+    }
+  }
+  free(state.sessions);
+  state.sessions = NULL;
+  state.sessions_len = 0;
+  if (state.watch) {
+    loop_del(state.loop, watch_fd(state.watch));
+    watch_free(state.watch);
+    state.watch = NULL;
+  }
+  if (state.reloading) {
+    pthread_join(reload_thread, NULL);
+    timeouts_free(state.reloaded);
+    state.reloaded = NULL;
+    state.reloading = false;
+  }
+  if (state.reload_efd >= 0) {
+    loop_del(state.loop, state.reload_efd);
+    close(state.reload_efd);
+    state.reload_efd = -1;
+  }
+  loop_destroy(state.loop);
+  state.loop = NULL;
+  schedule_free(state.schedule);
+  state.schedule = NULL;
+  state.alarms = NULL;
+  launch_destroy();
+}
+
+void state_restart() {
   dprintf("Restarting\n");
-  idle_reset(state.idle);
-  state.restart = true;
-  siglongjmp(startbuf, 1);
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    if (session->source && !session->finished) {
+      source_reset(session->source);
+      session_restart(session);
+    }
+  }
+}
+
+bool state_inhibited() {
+  return state.control && control_inhibited(state.control);
+}
+
+/*
+ * While inhibited the sessions keep their connection with the alarms
+ * disarmed, as on SIGTSTP. Taking the inhibition counts as activity: the
+ * timeouts already run are undone by the resets. Releasing it starts a new
+ * idle cycle.
+ */
+void state_inhibit(bool inhibit) {
+  dprintf(inhibit ? "Inhibited\n" : "Uninhibited\n");
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    if (!session->source || session->finished) {
+      continue;
+    }
+
+    if (!inhibit) {
+      source_resume(session->source);
+      session->cursor = 0;
+      if (session_wait(session)) {
+        session_process(session);
+      }
+      continue;
+    }
+
+    if (session->reset_timer >= 0) {
+      loop_timer_arm(session->reset_timer, 0);
+    }
+    if (session->reset_state != RESET_CONFIRMING) {
+      source_pause(session->source);
+    }
+    if (session->cursor || session->reset_state != RESET_NONE) {
+      session_reset(session, monotonic_ns());
+    }
+    session->reset_state = RESET_NONE;
+  }
+}
+
+const char *session_status(Session *session) {
+  if (session->finished) {
+    return "finished";
+  }
+  if (session->failed) {
+    return "failed";
+  }
+  if (state_inhibited()) {
+    return "inhibited";
+  }
+  if (session->reset_state == RESET_CONFIRMING) {
+    return "confirming";
+  }
+  return session->cursor ? "idle" : "active";
+}
+
+/* The next threshold of each session, `-` once they are all reached */
+void state_query(ControlClient *client) {
+  for (size_t i = 0; i < state.sessions_len; ++i) {
+    Session *session = &state.sessions[i];
+    const char *status = session_status(session);
+    uint64_t next = schedule_threshold(state.schedule, session->cursor);
+
+    if (next) {
+      control_reply(client, "session %s %s %lu", session_name(session),
+                    status, next);
+    } else {
+      control_reply(client, "session %s %s -", session_name(session),
+                    status);
+    }
+  }
+}
+
+void on_idle(__attribute__((unused)) Loop *loop, __attribute__((unused)) int fd,
+             __attribute__((unused)) uint32_t events, void *data) {
+  session_process(data);
+}
+
+void on_watch(__attribute__((unused)) Loop *loop,
+              __attribute__((unused)) int fd,
+              __attribute__((unused)) uint32_t events,
+              __attribute__((unused)) void *data) {
+  /* editors write in bursts: reload once things settle */
+  if (watch_changed(state.watch)) {
+    loop_timer_arm(state.reload_timer, CONFIG_RELOAD_DELAY);
+  }
+}
+
+void on_reload(__attribute__((unused)) Loop *loop,
+               __attribute__((unused)) int fd,
+               __attribute__((unused)) uint32_t events,
+               __attribute__((unused)) void *data) {
+  dprintf("Reloading %s\n", state.config);
+  state_load();
+}
+
+void on_reloaded(__attribute__((unused)) Loop *loop,
+                 __attribute__((unused)) int fd,
+                 __attribute__((unused)) uint32_t events,
+                 __attribute__((unused)) void *data) {
+  uint64_t v;
+
+  if (read(state.reload_efd, &v, sizeof(v)) < 0 || !state.reloading) {
+    return;
+  }
+
+  pthread_join(reload_thread, NULL);
+  state.reloading = false;
+  Timeouts *timeouts = state.reloaded;
+  state.reloaded = NULL;
+
+  if (state.reload_again) {
+    state.reload_again = false;
+    timeouts_free(timeouts);
+    state_load();
+    return;
+  }
+  state_reload(timeouts);
+}
+
+void on_metrics(__attribute__((unused)) Loop *loop,
+                __attribute__((unused)) int fd,
+                __attribute__((unused)) uint32_t events,
+                __attribute__((unused)) void *data) {
+  state_metrics();
+  loop_timer_arm(state.metrics_timer, METRICS_INTERVAL);
+}
+
+void on_reset(__attribute__((unused)) Loop *loop,
+              __attribute__((unused)) int fd,
+              __attribute__((unused)) uint32_t events, void *data) {
+  Session *session = data;
+
+  if (!session->source) {
+    return;
+  }
+
+  switch (session->reset_state) {
+  case RESET_NONE:
+    return;
+  case RESET_DEFERRED:
+    session_reset(session, session->reset_since);
+    return;
+  case RESET_CONFIRMING:
+    break;
+  }
+
+  uint64_t idle = source_idle_after(session->source, state.reset_activity);
+  source_resume(session->source);
+  session->reset_state = RESET_NONE;
+
+  if (idle < state.reset_activity) {
+    session_reset_limited(session, session->reset_since);
+  } else {
+    session_suppress(session);
+    source_dismiss(session->source);
+    session->cursor = session->reset_cursor;
+  }
+
+  if (session_wait(session)) {
+    session_process(session);
+  }
+}
+
+void on_signal(__attribute__((unused)) Loop *loop,
+               struct signalfd_siginfo *info,
+               __attribute__((unused)) void *data) {
+  trace_event(TRACE_SIGNAL, info->ssi_signo, info->ssi_pid, 0);
+  switch (info->ssi_signo) {
+  case SIGALRM:
+    state_restart();
+    break;
+  case SIGTSTP:
+    state_suspend();
+    break;
+  case SIGCONT:
+    dprintf("Resuming\n");
+    for (size_t i = 0; i < state.sessions_len; ++i) {
+      Session *session = &state.sessions[i];
+      if (session->finished) {
+        continue;
+      }
+      if (!session->source) {
+        session_reconnect(session);
+        continue;
+      }
+      if (state_inhibited()) {
+        continue;
+      }
+      source_resume(session->source);
+      session_restart(session);
+    }
+    break;
+  case SIGHUP:
+    state_reconnect();
+    break;
+  case SIGUSR1:
+    state_dump();
+    break;
+  }
 }
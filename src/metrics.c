@@ -0,0 +1,326 @@
+#include "metrics.h"
+#include "histogram.h"
+#include "util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+void metrics_render(Metrics *, FILE *);
+
+/*
+ * The textfile is written by a thread of its own, so a slow or hung directory
+ * (NFS, a full disk) never delays the commands. Only the latest snapshot is
+ * kept: one posted while the previous one is still waiting replaces it.
+ */
+static struct metrics_writer {
+  Metrics *pending;
+  int efd;
+  bool stop;
+  bool running;
+  pthread_t thread;
+} writer = {.efd = -1};
+
+static const char *const metrics_states[METRICS_STATES] = {
+    [ERROR] = "error",
+    [TIMEOUT] = "timeout",
+    [UNIDLE] = "unidle",
+    [PENDING] = NULL,
+    [FINISHED] = "finished",
+};
+
+Metrics *metrics_new(const char *path, Timeouts *timeouts, size_t sessions) {
+  Metrics *res = malloc(sizeof(Metrics));
+  res->path = path;
+  res->timeouts = timeouts_ref(timeouts);
+  res->sessions = calloc(sessions, sizeof(MetricsSession));
+  res->sessions_len = sessions;
+  return res;
+}
+
+/*
+ * The file is replaced with a rename, so the node exporter never reads it
+ * half written. Called by the metrics thread.
+ */
+bool metrics_write(Metrics *metrics) {
+  size_t len = strlen(metrics->path);
+  char *tmp = malloc(len + sizeof(".tmp"));
+  FILE *file;
+
+  memcpy(tmp, metrics->path, len);
+  memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+  if (!(file = fopen(tmp, "we"))) {
+    eprintf("Cannot open %s: %s\n", tmp, strerror(errno));
+    free(tmp);
+    return false;
+  }
+
+  metrics_render(metrics, file);
+  bool failed = ferror(file);
+  if (fclose(file) != 0 || failed) {
+    eprintf("Cannot write %s\n", tmp);
+    goto err;
+  }
+
+  if (rename(tmp, metrics->path) < 0) {
+    eprintf("Cannot rename %s: %s\n", tmp, strerror(errno));
+    goto err;
+  }
+
+  free(tmp);
+  return true;
+err:
+  unlink(tmp);
+  free(tmp);
+  return false;
+}
+
+void metrics_family(FILE *file, const char *name, const char *type,
+                    const char *help) {
+  fprintf(file, "# HELP xs_timeout_%s %s\n", name, help);
+  fprintf(file, "# TYPE xs_timeout_%s %s\n", name, type);
+}
+
+/* Label values escape backslashes, quotes and newlines */
+void metrics_label(FILE *file, const char *label, const char *value) {
+  fprintf(file, "%s=\"", label);
+  for (const char *c = value; *c; ++c) {
+    if (*c == '\\' || *c == '"') {
+      fputc('\\', file);
+      fputc(*c, file);
+    } else if (*c == '\n') {
+      fputs("\\n", file);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+void metrics_session(FILE *file, const char *name, MetricsSession *session) {
+  fprintf(file, "xs_timeout_%s{", name);
+  metrics_label(file, "session", session->name);
+  fputs("}", file);
+}
+
+/* Same form as everywhere else: seconds, or ms when they are not round */
+void metrics_threshold(FILE *file, const char *name, Callbacks *callbacks) {
+  fprintf(file, "xs_timeout_%s{threshold=\"", name);
+  if (callbacks->timeout) {
+    timeout_inspect(callbacks->timeout,
+                    (int (*)(void *, const char *, ...))fprintf, file);
+  } else {
+    fputs("reset", file);
+  }
+  fputs("\"", file);
+}
+
+void metrics_render(Metrics *metrics, FILE *file) {
+  Timeouts *timeouts = metrics->timeouts;
+
+  metrics_family(file, "transitions_total", "counter",
+                 "Idle transitions reported by the idle source.");
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    MetricsSession *session = &metrics->sessions[i];
+    for (size_t s = 0; s < METRICS_STATES; ++s) {
+      if (!metrics_states[s]) {
+        continue;
+      }
+      fputs("xs_timeout_transitions_total{", file);
+      metrics_label(file, "session", session->name);
+      fprintf(file, ",state=\"%s\"} %lu\n", metrics_states[s],
+              session->transitions[s]);
+    }
+  }
+
+  metrics_family(file, "x_requests_total", "counter",
+                 "X requests issued by the idle source.");
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    metrics_session(file, "x_requests_total", &metrics->sessions[i]);
+    fprintf(file, " %lu\n", metrics->sessions[i].requests);
+  }
+
+  metrics_family(file, "x_round_trips_total", "counter",
+                 "X round trips made by the idle source.");
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    metrics_session(file, "x_round_trips_total", &metrics->sessions[i]);
+    fprintf(file, " %lu\n", metrics->sessions[i].round_trips);
+  }
+
+  metrics_family(file, "reconnects_total", "counter",
+                 "Connections to the display opened again.");
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    metrics_session(file, "reconnects_total", &metrics->sessions[i]);
+    fprintf(file, " %lu\n", metrics->sessions[i].reconnects);
+  }
+
+  metrics_family(file, "idle_seconds", "gauge",
+                 "Idle time, from the last timeout or the last activity seen.");
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    uint64_t ms = metrics->sessions[i].idle;
+    metrics_session(file, "idle_seconds", &metrics->sessions[i]);
+    fprintf(file, " %lu.%03lu\n", ms / 1000, ms % 1000);
+  }
+
+  metrics_family(file, "threshold_seconds", "gauge",
+                 "Last threshold reached, 0 while the user is active.");
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    uint64_t ms = metrics->sessions[i].threshold;
+    metrics_session(file, "threshold_seconds", &metrics->sessions[i]);
+    fprintf(file, " %lu.%03lu\n", ms / 1000, ms % 1000);
+  }
+
+  metrics_family(file, "commands_spawned_total", "counter",
+                 "Commands started, by threshold.");
+  for (size_t i = 0; i < timeouts->len; ++i) {
+    Callbacks *callbacks = &timeouts->callbacks[i];
+    if (callbacks->len > callbacks->actions) {
+      metrics_threshold(file, "commands_spawned_total", callbacks);
+      fprintf(file, "} %lu\n",
+              __atomic_load_n(&callbacks->spawned, __ATOMIC_RELAXED));
+    }
+  }
+
+  metrics_family(file, "commands_failed_total", "counter",
+                 "Commands that could not be started, by threshold.");
+  for (size_t i = 0; i < timeouts->len; ++i) {
+    Callbacks *callbacks = &timeouts->callbacks[i];
+    if (callbacks->len > callbacks->actions) {
+      metrics_threshold(file, "commands_failed_total", callbacks);
+      fprintf(file, "} %lu\n",
+              __atomic_load_n(&callbacks->failed, __ATOMIC_RELAXED));
+    }
+  }
+
+  metrics_family(file, "spawn_latency_seconds", "summary",
+                 "From the alarm (or the activity) to each command running.");
+  for (size_t i = 0; i < timeouts->len; ++i) {
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    Callbacks *callbacks = &timeouts->callbacks[i];
+    Histogram *latency =
+        __atomic_load_n(&callbacks->latency, __ATOMIC_ACQUIRE);
+    if (!latency) {
+      continue;
+    }
+
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(*quantiles); ++q) {
+      uint64_t us = histogram_percentile(latency, quantiles[q] * 100);
+      metrics_threshold(file, "spawn_latency_seconds", callbacks);
+      fprintf(file, ",quantile=\"%g\"} %lu.%06lu\n", quantiles[q],
+              us / 1000000, us % 1000000);
+    }
+
+    uint64_t sum = __atomic_load_n(&latency->sum, __ATOMIC_RELAXED);
+    metrics_threshold(file, "spawn_latency_seconds_sum", callbacks);
+    fprintf(file, "} %lu.%06lu\n", sum / 1000000, sum % 1000000);
+    metrics_threshold(file, "spawn_latency_seconds_count", callbacks);
+    fprintf(file, "} %lu\n",
+            __atomic_load_n(&latency->total, __ATOMIC_RELAXED));
+  }
+}
+
+static void *metrics_thread(__attribute__((unused)) void *arg) {
+  while (1) {
+    Metrics *metrics =
+        __atomic_exchange_n(&writer.pending, NULL, __ATOMIC_ACQ_REL);
+    if (metrics) {
+      metrics_write(metrics);
+      metrics_free(metrics);
+      continue;
+    }
+
+    if (__atomic_load_n(&writer.stop, __ATOMIC_ACQUIRE) &&
+        !__atomic_load_n(&writer.pending, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+
+    uint64_t v;
+    if (read(writer.efd, &v, sizeof(v)) < 0) {
+      /* EINTR: just look again */
+    }
+  }
+
+  return NULL;
+}
+
+int metrics_start(void) {
+  sigset_t all, prev;
+
+  if (writer.running) {
+    return 0;
+  }
+
+  if ((writer.efd = eventfd(0, EFD_CLOEXEC)) < 0) {
+    return -1;
+  }
+  writer.stop = false;
+
+  /* Signals must only ever be delivered to the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &prev);
+  int res = pthread_create(&writer.thread, NULL, metrics_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+  if (res != 0) {
+    close(writer.efd);
+    writer.efd = -1;
+    return -1;
+  }
+
+  writer.running = true;
+  return 0;
+}
+
+/* Takes ownership of the snapshot, false when it replaced an unwritten one */
+bool metrics_post(Metrics *metrics) {
+  if (!writer.running) {
+    metrics_free(metrics);
+    return false;
+  }
+
+  Metrics *old =
+      __atomic_exchange_n(&writer.pending, metrics, __ATOMIC_ACQ_REL);
+  metrics_free(old);
+
+  uint64_t one = 1;
+  if (write(writer.efd, &one, sizeof(one)) < 0) {
+    dprintf("Cannot wake up the metrics thread\n");
+  }
+  return !old;
+}
+
+/* The last snapshot posted is written first */
+void metrics_stop(void) {
+  if (!writer.running) {
+    return;
+  }
+
+  __atomic_store_n(&writer.stop, true, __ATOMIC_RELEASE);
+  uint64_t one = 1;
+  if (write(writer.efd, &one, sizeof(one)) < 0) {
+    dprintf("Cannot wake up the metrics thread\n");
+  }
+  pthread_join(writer.thread, NULL);
+
+  close(writer.efd);
+  writer.efd = -1;
+  writer.running = false;
+}
+
+void metrics_free(Metrics *metrics) {
+  if (!metrics) {
+    return;
+  }
+
+  for (size_t i = 0; i < metrics->sessions_len; ++i) {
+    free(metrics->sessions[i].name);
+  }
+  free(metrics->sessions);
+  timeouts_free(metrics->timeouts);
+  free(metrics);
+}
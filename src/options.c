@@ -1,36 +1,75 @@
 #include "options.h"
+#include "action.h"
+#include "command.h"
+#include "plugin.h"
 #include "timeouts.h"
 #include "util.h"
 #include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
-#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <alloca.h>
 
 bool starts_with(const char *str, const char *pre) {
   return strncmp(pre, str, strlen(pre)) == 0;
 }
 
-Timeouts *parse_timeouts(char **timeouts, size_t timeouts_len);
+bool parse_ms(const char *str, uint32_t *ms) {
+  char *endptr = NULL;
+
+  errno = 0;
+  unsigned long long tmp = strtoull(str, &endptr, 10);
+  if (errno || endptr == str || *endptr || tmp > UINT32_MAX) {
+    eprintf("'%s` is not a valid number of milliseconds\n", str);
+    return false;
+  }
+
+  *ms = (uint32_t)tmp;
+  return true;
+}
 
 Options parse_options(int argc, char **argv) {
   int c;
-  char **timeouts = alloca(argc * sizeof(char *));
+  char **timeouts = malloc(argc * sizeof(char *));
   size_t timeouts_len = 0;
+  bool zygote = false;
+  bool multi_alarm = false;
+  bool batch = false;
+  uint32_t reset_activity = 0;
+  uint32_t reset_interval = 0;
+  char **displays = malloc(argc * sizeof(char *));
+  size_t displays_len = 0;
+  char **simulate = malloc(argc * sizeof(char *));
+  size_t simulate_len = 0;
+  char *config = NULL;
+  char *control = NULL;
+  char *trace = NULL;
+  char *metrics = NULL;
 
   while (1) {
     static struct option long_options[] = {
         {"help", no_argument, NULL, 0},
         {"version", no_argument, NULL, 0},
+        {"zygote", no_argument, NULL, 'z'},
+        {"multi-alarm", no_argument, NULL, 'm'},
+        {"batch", no_argument, NULL, 'b'},
+        {"reset-activity", required_argument, NULL, 'a'},
+        {"reset-interval", required_argument, NULL, 'i'},
+        {"display", required_argument, NULL, 'd'},
+        {"simulate", required_argument, NULL, 's'},
+        {"config", required_argument, NULL, 'c'},
+        {"plugin", required_argument, NULL, 'p'},
+        {"control", required_argument, NULL, 'C'},
+        {"trace", required_argument, NULL, 't'},
+        {"metrics", required_argument, NULL, 'M'},
         {0, 0, 0, 0},
     };
 
     int option_index = 0;
 
-    c = getopt_long(argc, argv, "hv", long_options, &option_index);
+    c = getopt_long(argc, argv, "hvzmba:i:d:s:c:p:C:t:M:", long_options,
+                    &option_index);
 
     if (c == -1) {
       break;
@@ -47,6 +86,49 @@ Options parse_options(int argc, char **argv) {
       goto help;
     case 'v':
       goto version;
+    case 'z':
+      zygote = true;
+      break;
+    case 'm':
+      multi_alarm = true;
+      break;
+    case 'b':
+      batch = true;
+      break;
+    case 'a':
+      if (!parse_ms(optarg, &reset_activity)) {
+        goto error;
+      }
+      break;
+    case 'i':
+      if (!parse_ms(optarg, &reset_interval)) {
+        goto error;
+      }
+      break;
+    case 'd':
+      displays[displays_len++] = optarg;
+      break;
+    case 's':
+      simulate[simulate_len++] = optarg;
+      break;
+    case 'c':
+      config = optarg;
+      break;
+    case 'C':
+      control = optarg;
+      break;
+    case 't':
+      trace = optarg;
+      break;
+    case 'M':
+      metrics = optarg;
+      break;
+    case 'p':
+      /* before the configuration using its actions is read */
+      if (!plugin_load(optarg)) {
+        goto error;
+      }
+      break;
     case '?':
       break;
     default:
@@ -59,41 +141,200 @@ Options parse_options(int argc, char **argv) {
     timeouts[timeouts_len++] = argv[i];
   }
 
-  Timeouts *ts = parse_timeouts(timeouts, timeouts_len);
-  if (!ts) {
-    return (Options){.help = false, .version = false, .timeouts = NULL};
-  }
-
-  return (Options){.help = false, .version = false, .timeouts = ts};
+  return (Options){.help = false,
+                   .version = false,
+                   .error = false,
+                   .zygote = zygote,
+                   .multi_alarm = multi_alarm,
+                   .batch = batch,
+                   .reset_activity = reset_activity,
+                   .reset_interval = reset_interval,
+                   .displays = displays,
+                   .displays_len = displays_len,
+                   .simulate = simulate,
+                   .simulate_len = simulate_len,
+                   .config = config,
+                   .control = control,
+                   .trace = trace,
+                   .metrics = metrics,
+                   .args = timeouts,
+                   .args_len = timeouts_len,
+                   .timeouts = load_timeouts(config, timeouts, timeouts_len)};
+error:
+  free(timeouts);
+  free(displays);
+  free(simulate);
+  return (Options){.help = false,
+                   .version = false,
+                   .error = true,
+                   .zygote = false,
+                   .multi_alarm = false,
+                   .batch = false,
+                   .reset_activity = 0,
+                   .reset_interval = 0,
+                   .displays = NULL,
+                   .displays_len = 0,
+                   .simulate = NULL,
+                   .simulate_len = 0,
+                   .config = NULL,
+                   .control = NULL,
+                   .trace = NULL,
+                   .metrics = NULL,
+                   .args = NULL,
+                   .args_len = 0,
+                   .timeouts = NULL};
 help:
-  return (Options){.help = true, .version = false, .timeouts = NULL};
+  free(timeouts);
+  free(displays);
+  free(simulate);
+  return (Options){.help = true,
+                   .version = false,
+                   .error = false,
+                   .zygote = false,
+                   .multi_alarm = false,
+                   .batch = false,
+                   .reset_activity = 0,
+                   .reset_interval = 0,
+                   .displays = NULL,
+                   .displays_len = 0,
+                   .simulate = NULL,
+                   .simulate_len = 0,
+                   .config = NULL,
+                   .control = NULL,
+                   .trace = NULL,
+                   .metrics = NULL,
+                   .args = NULL,
+                   .args_len = 0,
+                   .timeouts = NULL};
 version:
-  return (Options){.help = false, .version = true, .timeouts = NULL};
+  free(timeouts);
+  free(displays);
+  free(simulate);
+  return (Options){.help = false,
+                   .version = true,
+                   .error = false,
+                   .zygote = false,
+                   .multi_alarm = false,
+                   .batch = false,
+                   .reset_activity = 0,
+                   .reset_interval = 0,
+                   .displays = NULL,
+                   .displays_len = 0,
+                   .simulate = NULL,
+                   .simulate_len = 0,
+                   .config = NULL,
+                   .control = NULL,
+                   .trace = NULL,
+                   .metrics = NULL,
+                   .args = NULL,
+                   .args_len = 0,
+                   .timeouts = NULL};
 }
 
-#define TIMEOUT_MAX UINT32_MAX / 1000
+/* ms, the XSync counters are signed 64-bit */
+#define TIMEOUT_MAX INT64_MAX
 
-bool _parse_timeout(char *timeout, uint32_t *time, char **cmd) {
-  unsigned long long tmp;
-  char *endptr = NULL;
+/*
+ * Flags after the timeout: `,sh` and `,exec` force how the command is run,
+ * `,kill`, `,single` and `,restart` what happens to its running instances.
+ */
+bool parse_flags(char **flags, CommandMode *mode, unsigned *policy) {
+  char *p = *flags;
 
-  tmp = strtoull(timeout, &endptr, 10);
-  if (tmp == ULLONG_MAX && errno == ERANGE) {
-    eprintf("'%s` is not a valid timeout\n", timeout);
+  *mode = COMMAND_AUTO;
+  *policy = 0;
+  while (*p == ',') {
+    size_t len = strcspn(++p, ",:");
+    if (len == 2 && strncmp(p, "sh", len) == 0) {
+      *mode = COMMAND_SHELL;
+    } else if (len == 4 && strncmp(p, "exec", len) == 0) {
+      *mode = COMMAND_EXEC;
+    } else if (len == 4 && strncmp(p, "kill", len) == 0) {
+      *policy |= COMMAND_KILL;
+    } else if (len == 6 && strncmp(p, "single", len) == 0) {
+      *policy |= COMMAND_SINGLE;
+    } else if (len == 7 && strncmp(p, "restart", len) == 0) {
+      *policy |= COMMAND_RESTART;
+    } else {
+      return false;
+    }
+    p += len;
+  }
+
+  if (*p != ':' ||
+      (*policy & (COMMAND_SINGLE | COMMAND_RESTART)) ==
+          (COMMAND_SINGLE | COMMAND_RESTART)) {
     return false;
   }
-  if (tmp > TIMEOUT_MAX) {
-    eprintf("'%s` is not a valid timeout\n", timeout);
+
+  *flags = p + 1;
+  return true;
+}
+
+/*
+ * Seconds, down to the millisecond (`60`, `0.5`, `1.25s`), or milliseconds
+ * (`750ms`).
+ */
+bool parse_duration(char **str, uint64_t *ms) {
+  char *p = *str;
+  uint64_t value = 0, frac = 0;
+  int digits = 0;
+
+  if (!isdigit(*p)) {
     return false;
   }
+  for (; isdigit(*p); ++p) {
+    if (value > (TIMEOUT_MAX - (uint64_t)(*p - '0')) / 10) {
+      return false;
+    }
+    value = value * 10 + (uint64_t)(*p - '0');
+  }
+
+  if (*p == '.') {
+    for (++p; isdigit(*p); ++p) {
+      if (++digits > 3) {
+        return false;
+      }
+      frac = frac * 10 + (uint64_t)(*p - '0');
+    }
+    if (!digits) {
+      return false;
+    }
+    for (int i = digits; i < 3; ++i) {
+      frac *= 10;
+    }
+  }
+
+  if (p[0] == 'm' && p[1] == 's' && !digits) {
+    p += 2;
+  } else {
+    if (*p == 's') {
+      p++;
+    }
+    if (value > (TIMEOUT_MAX - frac) / 1000) {
+      return false;
+    }
+    value = value * 1000 + frac;
+  }
+
+  *ms = value;
+  *str = p;
+  return true;
+}
 
-  *time = (uint32_t)tmp;
+bool _parse_timeout(char *timeout, uint64_t *time, CommandMode *mode,
+                    unsigned *policy, char **cmd) {
+  char *endptr = timeout;
 
-  if (*endptr != ':') {
+  if (!parse_duration(&endptr, time)) {
+    eprintf("'%s` is not a valid timeout\n", timeout);
+    return false;
+  }
+
+  if (!parse_flags(&endptr, mode, policy)) {
     eprintf("'%s` is not a valid timeout\n", timeout);
     return false;
   }
-  endptr++;
   *cmd = endptr;
 
   while (*endptr && isspace(*endptr)) {
@@ -108,12 +349,18 @@ bool _parse_timeout(char *timeout, uint32_t *time, char **cmd) {
 }
 
 bool parse_timeout(Timeouts *timeouts, char *t) {
-  uint32_t time;
+  uint64_t time;
+  CommandMode mode;
+  unsigned policy;
   char *cmd;
 
-  if (starts_with(t, "reset:")) {
+  if (starts_with(t, "reset:") || starts_with(t, "reset,")) {
     time = 0;
-    cmd = t + (6 * sizeof(char));
+    cmd = t + (5 * sizeof(char));
+    if (!parse_flags(&cmd, &mode, &policy)) {
+      eprintf("'%s` is not a valid reset\n", t);
+      return false;
+    }
 
     char *endptr = cmd;
     while (*endptr && isspace(*endptr)) {
@@ -124,30 +371,90 @@ bool parse_timeout(Timeouts *timeouts, char *t) {
       return false;
     }
   } else {
-    if (!_parse_timeout(t, &time, &cmd)) {
+    if (!_parse_timeout(t, &time, &mode, &policy, &cmd)) {
       eprintf("'%s` is not a valid timeout\n", t);
       return false;
     }
   }
 
-  timeouts_dup_append(timeouts, time, cmd);
+  if (!action_check(cmd)) {
+    eprintf("'%s` is not a valid action\n", t);
+    return false;
+  }
+
+  if (!command_check(cmd, mode)) {
+    eprintf("'%s` is not a valid timeout\n", t);
+    return false;
+  }
+
+  timeouts_dup_append(timeouts, time, cmd, mode, policy);
   return true;
 }
 
-Timeouts *parse_timeouts(char **timeouts, size_t timeouts_len) {
-  if (!timeouts_len) {
+/*
+ * The config file has one timeout per line, with the same syntax as the
+ * command line. Empty lines and lines starting with '#' are ignored.
+ */
+bool parse_config(Timeouts *timeouts, const char *path) {
+  FILE *file;
+  char *line = NULL;
+  size_t line_len = 0;
+  size_t lineno = 0;
+  bool res = true;
+
+  if (!(file = fopen(path, "r"))) {
+    eprintf("Cannot open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  ssize_t len;
+  while ((len = getline(&line, &line_len, file)) != -1) {
+    lineno++;
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+
+    char *t = line;
+    while (isspace(*t)) {
+      t++;
+    }
+    if (!*t || *t == '#') {
+      continue;
+    }
+
+    if (!parse_timeout(timeouts, t)) {
+      eprintf("%s:%zu: invalid line\n", path, lineno);
+      res = false;
+      break;
+    }
+  }
+
+  free(line);
+  fclose(file);
+  return res;
+}
+
+/* Timeouts from the config file (if any) followed by the ones in args */
+Timeouts *load_timeouts(const char *config, char **args, size_t args_len) {
+  if (!config && !args_len) {
     return NULL;
   }
 
   Timeouts *res = timeouts_new();
 
-  for (size_t i = 0; i < timeouts_len; ++i) {
-    if (!parse_timeout(res, timeouts[i])) {
+  if (config && !parse_config(res, config)) {
+    timeouts_free(res);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < args_len; ++i) {
+    if (!parse_timeout(res, args[i])) {
       timeouts_free(res);
       return NULL;
     }
   }
 
+  timeouts_build(res);
   if (!res->len) {
     timeouts_free(res);
     res = NULL;
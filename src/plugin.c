@@ -0,0 +1,239 @@
+#include "plugin.h"
+#include "util.h"
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Plugins are loaded while the options are parsed, before the configuration
+ * that uses their actions. The blocking actions are run by a single worker
+ * thread, fed by the main loop through a queue that grows when it is full:
+ * the calls stay one at a time and in order, as the ABI promises, and the
+ * event loop never waits for a plugin.
+ */
+static struct plugins {
+  Plugin *list;
+  size_t len;
+  PluginAction **actions;
+  size_t actions_len;
+  PluginCall *queue;
+  size_t capacity;
+  size_t head;
+  size_t tail;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool stop;
+  bool running;
+  pthread_t thread;
+} plugins = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+void plugin_call(const PluginAction *action, uint64_t threshold, uint64_t idle,
+                 const char *arg) {
+  XsPluginEvent event = {threshold, idle, arg};
+  action->def.run(action->def.data, &event);
+}
+
+bool plugin_check(void *data, const char *arg) {
+  PluginAction *action = data;
+
+  if (action->def.check && action->def.check(action->def.data, arg) != 0) {
+    eprintf("'%s` is not a valid argument for @%s\n", arg, action->def.name);
+    return false;
+  }
+  return true;
+}
+
+/* Called with the lock held, the calls keep their order */
+void plugin_grow(void) {
+  size_t capacity = plugins.capacity * 2;
+  PluginCall *queue = malloc(capacity * sizeof(PluginCall));
+
+  for (size_t i = plugins.head; i != plugins.tail; ++i) {
+    queue[i % capacity] = plugins.queue[i % plugins.capacity];
+  }
+  free(plugins.queue);
+  plugins.queue = queue;
+  plugins.capacity = capacity;
+}
+
+void plugin_run(void *data, const char *arg, ActionContext *ctx) {
+  PluginAction *action = data;
+
+  if ((action->def.flags & XS_PLUGIN_NONBLOCKING) || !plugins.running) {
+    plugin_call(action, ctx->threshold, ctx->idle, arg);
+    return;
+  }
+
+  pthread_mutex_lock(&plugins.lock);
+  if (plugins.tail - plugins.head >= plugins.capacity) {
+    plugin_grow();
+    dprintf("Plugin queue grown to %zu calls\n", plugins.capacity);
+  }
+
+  plugins.queue[plugins.tail++ % plugins.capacity] =
+      (PluginCall){action, ctx->threshold, ctx->idle, strdup(arg)};
+  pthread_cond_signal(&plugins.cond);
+  pthread_mutex_unlock(&plugins.lock);
+}
+
+void *plugin_thread(__attribute__((unused)) void *arg) {
+  pthread_mutex_lock(&plugins.lock);
+  while (1) {
+    while (plugins.head == plugins.tail && !plugins.stop) {
+      pthread_cond_wait(&plugins.cond, &plugins.lock);
+    }
+    if (plugins.head == plugins.tail) {
+      break;
+    }
+
+    PluginCall call = plugins.queue[plugins.head++ % plugins.capacity];
+    pthread_mutex_unlock(&plugins.lock);
+    plugin_call(call.action, call.threshold, call.idle, call.arg);
+    free(call.arg);
+    pthread_mutex_lock(&plugins.lock);
+  }
+  pthread_mutex_unlock(&plugins.lock);
+
+  return NULL;
+}
+
+bool plugin_start(void) {
+  sigset_t all, prev;
+
+  plugins.queue = malloc(PLUGIN_QUEUE_SIZE * sizeof(PluginCall));
+  plugins.capacity = PLUGIN_QUEUE_SIZE;
+
+  /* Signals must only ever be delivered to the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &prev);
+  int res = pthread_create(&plugins.thread, NULL, plugin_thread, NULL);
+  pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+  plugins.running = res == 0;
+  return plugins.running;
+}
+
+int plugin_register(const XsPluginAction *def) {
+  if (!def->name || !*def->name || def->name[strcspn(def->name, " \t@")] ||
+      !def->run) {
+    eprintf("Invalid plugin action '%s`\n", def->name ? def->name : "");
+    return -1;
+  }
+
+  if (action_lookup(def->name, strlen(def->name))) {
+    eprintf("Action @%s already exists\n", def->name);
+    return -1;
+  }
+
+  PluginAction *action = malloc(sizeof(PluginAction));
+  action->def = *def;
+  action->action = (Action){
+      .name = def->name,
+      .data = action,
+      .check = plugin_check,
+      .run = plugin_run,
+      .reset = NULL,
+  };
+
+  plugins.actions = realloc(plugins.actions, (plugins.actions_len + 1) *
+                                                 sizeof(PluginAction *));
+  plugins.actions[plugins.actions_len++] = action;
+  dprintf("Registered @%s\n", def->name);
+  return 0;
+}
+
+static const XsPluginHost plugin_host = {
+    .abi = XS_PLUGIN_ABI,
+    .register_action = plugin_register,
+};
+
+bool plugin_load(const char *path) {
+  int (*init)(const XsPluginHost *);
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+  if (!handle) {
+    eprintf("Cannot load %s: %s\n", path, dlerror());
+    return false;
+  }
+
+  const unsigned *abi = dlsym(handle, "xs_plugin_abi");
+  if (!abi || *abi != XS_PLUGIN_ABI) {
+    eprintf("%s: not a plugin for ABI %u\n", path, XS_PLUGIN_ABI);
+    dlclose(handle);
+    return false;
+  }
+
+  /* ISO C has no cast from an object pointer to a function pointer */
+  *(void **)&init = dlsym(handle, "xs_plugin_init");
+  size_t registered = plugins.actions_len;
+  if (!init || init(&plugin_host) != 0) {
+    eprintf("%s: initialization failed\n", path);
+    while (plugins.actions_len > registered) {
+      free(plugins.actions[--plugins.actions_len]);
+    }
+    dlclose(handle);
+    return false;
+  }
+
+  plugins.list = realloc(plugins.list, (plugins.len + 1) * sizeof(Plugin));
+  Plugin *plugin = &plugins.list[plugins.len++];
+  plugin->handle = handle;
+  *(void **)&plugin->exit = dlsym(handle, "xs_plugin_exit");
+
+  for (size_t i = registered; i < plugins.actions_len; ++i) {
+    if (!(plugins.actions[i]->def.flags & XS_PLUGIN_NONBLOCKING) &&
+        !plugins.running && !plugin_start()) {
+      eprintf("Cannot start the plugin thread, blocking actions run inline\n");
+      break;
+    }
+  }
+
+  return true;
+}
+
+const Action *plugin_find(const char *name, size_t len) {
+  for (size_t i = 0; i < plugins.actions_len; ++i) {
+    const char *candidate = plugins.actions[i]->def.name;
+    if (strlen(candidate) == len && strncmp(candidate, name, len) == 0) {
+      return &plugins.actions[i]->action;
+    }
+  }
+
+  return NULL;
+}
+
+/* The queued calls are made before the plugins go away */
+void plugin_destroy(void) {
+  if (plugins.running) {
+    pthread_mutex_lock(&plugins.lock);
+    plugins.stop = true;
+    pthread_cond_signal(&plugins.cond);
+    pthread_mutex_unlock(&plugins.lock);
+    pthread_join(plugins.thread, NULL);
+    plugins.running = false;
+  }
+  free(plugins.queue);
+  plugins.queue = NULL;
+  plugins.capacity = 0;
+
+  for (size_t i = 0; i < plugins.len; ++i) {
+    if (plugins.list[i].exit) {
+      plugins.list[i].exit();
+    }
+    dlclose(plugins.list[i].handle);
+  }
+  free(plugins.list);
+  plugins.list = NULL;
+  plugins.len = 0;
+
+  for (size_t i = 0; i < plugins.actions_len; ++i) {
+    free(plugins.actions[i]);
+  }
+  free(plugins.actions);
+  plugins.actions = NULL;
+  plugins.actions_len = 0;
+}
@@ -0,0 +1,123 @@
+#include "schedule.h"
+#include "histogram.h"
+
+#include <stdlib.h>
+
+/*
+ * Takes ownership of the timeouts. Callbacks are kept sorted by timeout while
+ * parsing, so the reset commands (timeout 0) can only be the first entry.
+ */
+Schedule *schedule_compile(Timeouts *timeouts) {
+  Schedule *res = calloc(1, sizeof(Schedule));
+  res->timeouts = timeouts;
+  res->steps = timeouts->callbacks;
+  res->len = timeouts->len;
+
+  if (res->len && res->steps[0].timeout == 0) {
+    res->reset = res->steps;
+    res->steps++;
+    res->len--;
+  }
+
+  if (res->len) {
+    res->thresholds = malloc(res->len * sizeof(uint64_t));
+    for (size_t i = 0; i < res->len; ++i) {
+      res->thresholds[i] = res->steps[i].timeout;
+    }
+  }
+
+  return res;
+}
+
+/* Threshold at the cursor, 0 once every threshold has been reached */
+inline uint64_t schedule_threshold(Schedule *schedule, size_t cursor) {
+  return cursor < schedule->len ? schedule->thresholds[cursor] : 0;
+}
+
+/* Cursor on the first threshold after `reached` */
+size_t schedule_cursor(Schedule *schedule, uint64_t reached) {
+  size_t p = 0, r = schedule->len;
+
+  while (p < r) {
+    size_t q = (p + r) / 2;
+    if (schedule->thresholds[q] <= reached) {
+      p = q + 1;
+    } else {
+      r = q;
+    }
+  }
+
+  return p;
+}
+
+/*
+ * Cursor past the thresholds reached, moving on from `cursor`: usually one
+ * step, so a transition stays O(1) where schedule_cursor() is O(log n).
+ */
+size_t schedule_advance(Schedule *schedule, size_t cursor, uint64_t reached) {
+  while (cursor < schedule->len && schedule->thresholds[cursor] <= reached) {
+    cursor++;
+  }
+  return cursor;
+}
+
+/* Cursor in `to` past the thresholds reached at `cursor` in `from` */
+size_t schedule_remap(Schedule *from, Schedule *to, size_t cursor) {
+  if (!cursor) {
+    return 0;
+  }
+  return schedule_cursor(to, schedule_threshold(from, cursor - 1));
+}
+
+/* Runs the steps from `from` up to `to` excluded as a single transition */
+size_t schedule_exec(Schedule *schedule, size_t from, size_t to,
+                     uint64_t since, char **envp, Source *source) {
+  to = to < schedule->len ? to : schedule->len;
+  if (from >= to) {
+    return 0;
+  }
+
+  return callbacks_exec(&schedule->steps[from], to - from, since, envp,
+                        source);
+}
+
+size_t schedule_exec_reset(Schedule *schedule, uint64_t since, char **envp,
+                           Source *source) {
+  return callbacks_reset(schedule->reset, since, envp, source);
+}
+
+int schedule_inspect_latency(Schedule *schedule,
+                             int (*printer)(void *, const char *, ...),
+                             void *arg) {
+  int sum = 0;
+
+  if (schedule->reset && schedule->reset->latency) {
+    sum += printer(arg, "reset: ");
+    sum += histogram_inspect(schedule->reset->latency, printer, arg);
+    sum += printer(arg, "\n");
+  }
+
+  for (size_t i = 0; i < schedule->len; ++i) {
+    Callbacks *callbacks = &schedule->steps[i];
+    if (!callbacks->latency) {
+      continue;
+    }
+
+    sum += timeout_inspect(callbacks->timeout, printer, arg);
+    sum += printer(arg, ": ");
+    sum += histogram_inspect(callbacks->latency, printer, arg);
+    sum += printer(arg, "\n");
+  }
+
+  return sum;
+}
+
+void schedule_free(Schedule *schedule) {
+  if (!schedule) {
+    return;
+  }
+
+  timeouts_free(schedule->timeouts);
+  free(schedule->thresholds);
+  free(schedule);
+}
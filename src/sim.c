@@ -0,0 +1,295 @@
+#include "sim.h"
+#include "util.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+bool sim_parse_line(Sim *, char *, size_t);
+void sim_input(Sim *, int64_t);
+int64_t sim_later(int64_t, int64_t);
+
+/*
+ * The script is a list of lines:
+ *   idle <ms>     the user stays idle for <ms>, then touches the input
+ *   sleep <ms>    same, but the machine is suspended meanwhile: every
+ *                 threshold crossed is reported late, at wake up
+ *   repeat <n>    replay the whole script <n> times
+ * Empty lines and lines starting with '#' are ignored. Once the script is
+ * over the user stays idle forever: the remaining timeouts are reported and
+ * then the source is FINISHED.
+ */
+Sim *sim_create(const char *path) {
+  FILE *file = NULL;
+  char *line = NULL;
+  size_t line_len = 0;
+  size_t lineno = 0;
+
+  Sim *res = calloc(1, sizeof(Sim));
+  res->fd = -1;
+  res->repeat = 1;
+
+  if (!(file = fopen(path, "r"))) {
+    eprintf("Cannot open %s: %s\n", path, strerror(errno));
+    goto err;
+  }
+
+  while (getline(&line, &line_len, file) != -1) {
+    if (!sim_parse_line(res, line, ++lineno)) {
+      goto err;
+    }
+  }
+
+  if (!res->len) {
+    eprintf("%s: empty script\n", path);
+    goto err;
+  }
+
+  if ((res->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+    eprintf("Cannot create eventfd: %s\n", strerror(errno));
+    goto err;
+  }
+
+  /* Always readable while running: every loop turn replays a transition */
+  sim_resume(res);
+
+  free(line);
+  fclose(file);
+  return res;
+err:
+  free(line);
+  if (file) {
+    fclose(file);
+  }
+  sim_close(res);
+  return NULL;
+}
+
+bool sim_parse_line(Sim *sim, char *line, size_t lineno) {
+  char *cmd = line;
+  char *endptr;
+
+  while (isspace(*cmd)) {
+    cmd++;
+  }
+  if (!*cmd || *cmd == '#') {
+    return true;
+  }
+
+  char *arg = cmd;
+  while (*arg && !isspace(*arg)) {
+    arg++;
+  }
+
+  errno = 0;
+  unsigned long long value = strtoull(arg, &endptr, 10);
+  if (errno || endptr == arg) {
+    goto err;
+  }
+  while (isspace(*endptr)) {
+    endptr++;
+  }
+  if (*endptr) {
+    goto err;
+  }
+
+  bool idle = arg - cmd == 4 && strncmp(cmd, "idle", 4) == 0;
+  bool asleep = arg - cmd == 5 && strncmp(cmd, "sleep", 5) == 0;
+  if ((idle || asleep) && value <= INT64_MAX) {
+    if (sim->len >= sim->allocated) {
+      sim->allocated += 64;
+      sim->script = realloc(sim->script, sim->allocated * sizeof(SimStep));
+    }
+    sim->script[sim->len].idle = (int64_t)value;
+    sim->script[sim->len++].asleep = asleep;
+    return true;
+  }
+
+  if (arg - cmd == 6 && strncmp(cmd, "repeat", 6) == 0 && value) {
+    sim->repeat = value;
+    return true;
+  }
+
+err:
+  eprintf("Invalid script line %zu: %s", lineno, line);
+  return false;
+}
+
+int sim_fd(Sim *sim) { return sim->fd; }
+
+bool sim_arm(Sim *sim, uint64_t timeout) {
+  sim->target = timeout > INT64_MAX ? INT64_MAX : (int64_t)timeout;
+  return true;
+}
+
+/* The simulated time `ms` after `at`, saturated: a timeout can be INT64_MAX */
+int64_t sim_later(int64_t at, int64_t ms) {
+  return ms > INT64_MAX - at ? INT64_MAX : at + ms;
+}
+
+SelectResult sim_event(Sim *sim, SelectResult res) {
+  sim->event_time = monotonic_ns();
+  sim->yield = true;
+  return res;
+}
+
+SelectResult sim_dispatch(Sim *sim) {
+  if (sim->paused) {
+    return PENDING;
+  }
+
+  if (sim->yield) {
+    sim->yield = false;
+    return PENDING;
+  }
+
+  while (1) {
+    bool over = sim->round >= sim->repeat;
+    int64_t input =
+        over ? INT64_MAX
+             : sim_later(sim->last_input, sim->script[sim->pos].idle);
+    int64_t at = sim_later(sim->last_input, sim->target);
+
+    if (sim->target && at <= input) {
+      if (!over && sim->script[sim->pos].asleep) {
+        at = input;
+      }
+      /* a threshold added by a reload may already be behind */
+      sim->now = at > sim->now ? at : sim->now;
+      sim->idle_time = sim->now - sim->last_input;
+      sim->target = 0;
+      sim->timed_out = true;
+      return sim_event(sim, TIMEOUT);
+    }
+
+    if (over) {
+      dprintf("Script over after %ld simulated ms\n", sim->now);
+      sim_pause(sim);
+      return FINISHED;
+    }
+
+    sim_input(sim, input);
+
+    if (sim->timed_out) {
+      sim->timed_out = false;
+      sim->stats.cycles++;
+      return sim_event(sim, UNIDLE);
+    }
+  }
+}
+
+void sim_input(Sim *sim, int64_t input) {
+  sim->now = sim->last_input = input;
+  if (++sim->pos >= sim->len) {
+    sim->pos = 0;
+    sim->round++;
+  }
+}
+
+void sim_reset(Sim *sim) { sim->timed_out = false; }
+
+/* The clock moves `ms` forward, the inputs meanwhile are just consumed */
+uint64_t sim_idle_after(Sim *sim, uint32_t ms) {
+  int64_t at = sim_later(sim->now, ms);
+
+  while (sim->round < sim->repeat &&
+         sim_later(sim->last_input, sim->script[sim->pos].idle) <= at) {
+    sim_input(sim, sim_later(sim->last_input, sim->script[sim->pos].idle));
+  }
+  sim->now = at;
+
+  return (uint64_t)(sim->now - sim->last_input);
+}
+
+void sim_dismiss(Sim *sim) { sim->timed_out = true; }
+
+void sim_pause(Sim *sim) {
+  uint64_t value;
+
+  sim->paused = true;
+  if (read(sim->fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    eprintf("Cannot read eventfd: %s\n", strerror(errno));
+  }
+}
+
+void sim_resume(Sim *sim) {
+  uint64_t value = 1;
+
+  sim->paused = false;
+  if (write(sim->fd, &value, sizeof(value)) < 0) {
+    eprintf("Cannot write eventfd: %s\n", strerror(errno));
+  }
+}
+
+IdleStats *sim_stats(Sim *sim) { return &sim->stats; }
+
+void sim_close(Sim *sim) {
+  if (!sim) {
+    return;
+  }
+
+  if (sim->fd >= 0) {
+    close(sim->fd);
+  }
+  free(sim->script);
+  free(sim);
+}
+
+void *sim_backend_create(const char *arg,
+                         __attribute__((unused)) const uint64_t *thresholds,
+                         __attribute__((unused)) size_t thresholds_len) {
+  return sim_create(arg);
+}
+
+int sim_backend_fd(void *sim) { return sim_fd(sim); }
+
+bool sim_backend_arm(void *sim, uint64_t timeout) {
+  return sim_arm(sim, timeout);
+}
+
+SelectResult sim_backend_dispatch(void *sim) { return sim_dispatch(sim); }
+
+void sim_backend_reset(void *sim) { sim_reset(sim); }
+
+void sim_backend_pause(void *sim) { sim_pause(sim); }
+
+void sim_backend_resume(void *sim) { sim_resume(sim); }
+
+uint64_t sim_backend_event_time(void *sim) {
+  return ((Sim *)sim)->event_time;
+}
+
+uint64_t sim_backend_idle_time(void *sim) {
+  return (uint64_t)((Sim *)sim)->idle_time;
+}
+
+uint64_t sim_backend_idle_after(void *sim, uint32_t ms) {
+  return sim_idle_after(sim, ms);
+}
+
+void sim_backend_dismiss(void *sim) { sim_dismiss(sim); }
+
+IdleStats *sim_backend_stats(void *sim) { return sim_stats(sim); }
+
+void sim_backend_close(void *sim) { sim_close(sim); }
+
+const SourceBackend sim_backend = {
+    .name = "sim",
+    .create = sim_backend_create,
+    .fd = sim_backend_fd,
+    .arm = sim_backend_arm,
+    .dispatch = sim_backend_dispatch,
+    .reset = sim_backend_reset,
+    .pause = sim_backend_pause,
+    .resume = sim_backend_resume,
+    .event_time = sim_backend_event_time,
+    .idle_time = sim_backend_idle_time,
+    .idle_after = sim_backend_idle_after,
+    .dismiss = sim_backend_dismiss,
+    .set_thresholds = NULL,
+    .stats = sim_backend_stats,
+    .close = sim_backend_close,
+};
@@ -0,0 +1,68 @@
+#include "source.h"
+
+#include <stdlib.h>
+
+Source *source_create(const SourceBackend *backend, const char *arg,
+                      const uint64_t *thresholds, size_t thresholds_len) {
+  void *impl = backend->create(arg, thresholds, thresholds_len);
+  if (!impl) {
+    return NULL;
+  }
+
+  Source *res = malloc(sizeof(Source));
+  res->backend = backend;
+  res->impl = impl;
+  return res;
+}
+
+int source_fd(Source *source) { return source->backend->fd(source->impl); }
+
+bool source_arm(Source *source, uint64_t timeout) {
+  return source->backend->arm(source->impl, timeout);
+}
+
+SelectResult source_dispatch(Source *source) {
+  return source->backend->dispatch(source->impl);
+}
+
+void source_reset(Source *source) { source->backend->reset(source->impl); }
+
+void source_pause(Source *source) { source->backend->pause(source->impl); }
+
+void source_resume(Source *source) { source->backend->resume(source->impl); }
+
+uint64_t source_event_time(Source *source) {
+  return source->backend->event_time(source->impl);
+}
+
+uint64_t source_idle_time(Source *source) {
+  return source->backend->idle_time(source->impl);
+}
+
+uint64_t source_idle_after(Source *source, uint32_t ms) {
+  return source->backend->idle_after(source->impl, ms);
+}
+
+void source_dismiss(Source *source) { source->backend->dismiss(source->impl); }
+
+bool source_set_thresholds(Source *source, const uint64_t *thresholds,
+                           size_t thresholds_len) {
+  if (!source->backend->set_thresholds) {
+    return true;
+  }
+  return source->backend->set_thresholds(source->impl, thresholds,
+                                         thresholds_len);
+}
+
+IdleStats *source_stats(Source *source) {
+  return source->backend->stats(source->impl);
+}
+
+void source_close(Source *source) {
+  if (!source) {
+    return;
+  }
+
+  source->backend->close(source->impl);
+  free(source);
+}
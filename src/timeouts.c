@@ -1,183 +1,222 @@
 #include "timeouts.h"
-#include "daemon.h"
+#include "dispatch.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 inline size_t callbacks_len(Callbacks *callbacks) { return callbacks->len; }
 
-void callbacks_shrink_to_fit(Callbacks *callbacks) {
-  if (!callbacks->len) {
-    if (callbacks->cmds) {
-      free(callbacks->cmds);
-      callbacks->cmds = NULL;
+/* The actions of `len` consecutive groups, in the order of the config */
+void callbacks_actions(Callbacks *callbacks, size_t len, ActionContext *ctx) {
+  for (size_t g = 0; g < len; ++g) {
+    ctx->threshold = callbacks[g].timeout;
+    for (size_t i = 0; callbacks[g].actions && i < callbacks[g].len; ++i) {
+      const Command *cmd = &callbacks[g].cmds[i];
+      if (cmd->action) {
+        cmd->action->run(cmd->action->data, cmd->arg, ctx);
+      }
     }
-  } else {
-    callbacks->cmds =
-        realloc(callbacks->cmds, callbacks->len * sizeof(char **));
   }
-
-  callbacks->allocated = callbacks->len;
 }
 
-void _callbacks_free(Callbacks *callbacks) {
-  for (size_t i = 0; i < callbacks->len; ++i) {
-    free(callbacks->cmds[i]);
+/*
+ * Executes `len` consecutive groups: the processes are queued first, so the
+ * spawner thread starts them while the actions run. Returns the number of
+ * commands.
+ */
+size_t callbacks_exec(Callbacks *callbacks, size_t len, uint64_t since,
+                      char **envp, Source *source) {
+  size_t sum = 0, actions = 0;
+
+  if (!callbacks) {
+    return 0;
   }
-}
 
-void callbacks_append(Callbacks *callbacks, char *cmd) {
-  if (!callbacks->cmds) {
-    callbacks->cmds = malloc(10 * sizeof(char *));
-    callbacks->allocated = 10;
-  } else if (callbacks->len <= callbacks->allocated) {
-    size_t new_size = callbacks->len + 10;
-    callbacks->cmds = realloc(callbacks->cmds, new_size * sizeof(char *));
-    callbacks->allocated = new_size;
+  for (size_t i = 0; i < len; ++i) {
+    size_t processes = callbacks[i].len - callbacks[i].actions;
+    if (processes && !callbacks[i].latency) {
+      /* published for the metrics, rendered by the spawner thread */
+      __atomic_store_n(&callbacks[i].latency, histogram_new(),
+                       __ATOMIC_RELEASE);
+    }
+    sum += processes;
+    actions += callbacks[i].actions;
   }
 
-  callbacks->cmds[callbacks->len++] = cmd;
-}
+  if (sum && !dispatch_push(callbacks, len, since, envp)) {
+    sum = 0;
+  }
+
+  if (actions) {
+    ActionContext ctx = {source, 0, source_idle_time(source)};
+    callbacks_actions(callbacks, len, &ctx);
+  }
 
-void callbacks_dup_append(Callbacks *callbacks, char *cmd) {
-  callbacks_append(callbacks, strdup(cmd));
+  return sum + actions;
 }
 
-size_t callbacks_exec(Callbacks *callbacks) {
-  size_t count = 0;
+/*
+ * The reset commands, after the instances killed on reset and the state left
+ * by the actions undone
+ */
+size_t callbacks_reset(Callbacks *callbacks, uint64_t since, char **envp,
+                       Source *source) {
+  if (callbacks && callbacks->len > callbacks->actions &&
+      !callbacks->latency) {
+    __atomic_store_n(&callbacks->latency, histogram_new(), __ATOMIC_RELEASE);
+  }
 
-  if (callbacks) {
-    for (size_t i = 0; i < callbacks->len; ++i) {
-      daemonize(callbacks->cmds[i]);
-      count++;
-    }
+  dispatch_reset(callbacks, since, envp);
+
+  ActionContext ctx = {source, 0, 0};
+  action_reset(&ctx);
+  if (callbacks && callbacks->actions) {
+    callbacks_actions(callbacks, 1, &ctx);
   }
+  return callbacks ? callbacks->len : 0;
+}
 
-  return count;
+/* As it would be written on the command line */
+int timeout_inspect(uint64_t timeout, int (*printer)(void *, const char *, ...),
+                    void *arg) {
+  if (timeout % 1000) {
+    return printer(arg, "%lums", timeout);
+  }
+  return printer(arg, "%lu", timeout / 1000);
 }
 
 int callbacks_inspect(Callbacks *callbacks,
                       int (*printer)(void *, const char *, ...), void *arg) {
   int sum = 0;
-  sum += printer(arg, "%ld: [", callbacks->timeout);
+  sum += timeout_inspect(callbacks->timeout, printer, arg);
+  sum += printer(arg, ": [");
   for (size_t i = 0; i < callbacks->len; ++i) {
     if (i != 0) {
       sum += printer(arg, ", ");
     }
-    sum += printer(arg, "\"%s\"", callbacks->cmds[i]);
+    const Command *cmd = &callbacks->cmds[i];
+    sum += printer(arg, cmd->action ? "%s" : cmd->argv ? "\"%s\"" : "sh \"%s\"",
+                   cmd->line);
   }
   sum += printer(arg, "]");
 
   return sum;
 }
 
-Timeouts *timeouts_new(void) { return calloc(1, sizeof(Timeouts)); }
+Timeouts *timeouts_new(void) {
+  Timeouts *res = calloc(1, sizeof(Timeouts));
+  res->refs = 1;
+  res->arena = arena_new();
+  res->entries_tail = &res->entries;
+  return res;
+}
 
 inline size_t timeouts_len(Timeouts *timeouts) { return timeouts->len; }
 
-void timeouts_shrink_to_fit(Timeouts *timeouts) {
-  if (timeouts->len) {
-    if (timeouts->callbacks) {
-      free(timeouts->callbacks);
-      timeouts->callbacks = NULL;
-    }
-  } else {
-    timeouts->callbacks =
-        realloc(timeouts->callbacks, timeouts->len * sizeof(Callbacks *));
-  }
-  timeouts->allocated = timeouts->len;
-
-  for (size_t i = 0; i < timeouts->len; ++i) {
-    callbacks_shrink_to_fit(&timeouts->callbacks[i]);
-  }
+Timeouts *timeouts_ref(Timeouts *timeouts) {
+  __atomic_add_fetch(&timeouts->refs, 1, __ATOMIC_RELAXED);
+  return timeouts;
 }
 
+/* Drops a reference, the last one releases everything */
 void timeouts_free(Timeouts *timeouts) {
-  if (!timeouts) {
+  if (!timeouts ||
+      __atomic_sub_fetch(&timeouts->refs, 1, __ATOMIC_ACQ_REL) != 0) {
     return;
   }
 
   for (size_t i = 0; i < timeouts->len; ++i) {
-    _callbacks_free(&timeouts->callbacks[i]);
+    histogram_free(timeouts->callbacks[i].latency);
   }
+  arena_free(timeouts->arena);
   free(timeouts);
 }
 
-void timeouts_ensure_alloc(Timeouts *timeouts, size_t new_len) {
-  if (!timeouts->callbacks) {
-    timeouts->callbacks = malloc(10 * sizeof(Callbacks));
-    timeouts->allocated = 10;
-  } else if (new_len > timeouts->allocated) {
-    size_t new_alloc = new_len / 10 + ((new_len % 10 != 0) ? 1 : 0);
-    timeouts->callbacks =
-        realloc(timeouts->callbacks, new_alloc * sizeof(Callbacks));
-    timeouts->allocated = new_alloc;
-  }
+void timeouts_dup_append(Timeouts *timeouts, uint64_t time, const char *cmd,
+                         CommandMode mode, unsigned policy) {
+  TimeoutEntry *entry = arena_alloc(timeouts->arena, sizeof(TimeoutEntry));
+  entry->timeout = time;
+  entry->seq = timeouts->entries_len++;
+  entry->mode = mode;
+  entry->policy = policy;
+  entry->cmd = arena_strdup(timeouts->arena, cmd);
+  entry->next = NULL;
+
+  *timeouts->entries_tail = entry;
+  timeouts->entries_tail = &entry->next;
 }
 
-void timeouts_insert_at(Timeouts *timeouts, size_t pos, uint32_t time) {
-  timeouts_ensure_alloc(timeouts, timeouts->len + 1);
-  if (pos < timeouts->len) {
-    memmove(timeouts->callbacks + pos + 1, timeouts->callbacks + pos,
-            (timeouts->len - pos) * sizeof(Callbacks));
-  } else {
-    pos = timeouts->len; // force last position
+int timeout_entry_cmp(const void *a, const void *b) {
+  const TimeoutEntry *x = *(const TimeoutEntry **)a;
+  const TimeoutEntry *y = *(const TimeoutEntry **)b;
+
+  if (x->timeout != y->timeout) {
+    return x->timeout < y->timeout ? -1 : 1;
   }
-  memset(timeouts->callbacks + (pos * sizeof(Callbacks)), 0, sizeof(Callbacks));
-  timeouts->callbacks[pos].timeout = time;
-  timeouts->len++;
+  return x->seq < y->seq ? -1 : (x->seq > y->seq);
 }
 
-size_t timeouts_get_exact_or_next_index(Timeouts *timeouts, uint32_t time) {
-  if (!timeouts->callbacks) {
-    return 0;
-  } else {
-    size_t p = 0, r = timeouts->len - 1;
-
-    if (time < timeouts->callbacks[0].timeout) {
-      return 0;
-    } else if (time > timeouts->callbacks[r].timeout) {
-      return timeouts->len;
-    } else {
-      while (p <= r) {
-        size_t q = (p + r) / 2;
-        if (timeouts->callbacks[q].timeout == time) {
-          return q;
-        }
-
-        if (timeouts->callbacks[q].timeout > time) {
-          r = q - 1;
-        } else {
-          p = q + 1;
-        }
-      }
+/*
+ * Groups the entries by timeout, keeping the parse order of the commands: one
+ * Callbacks array and one Command array, both sized exactly. Commands are
+ * classified (and looked up in PATH) here, once.
+ */
+void timeouts_build(Timeouts *timeouts) {
+  size_t len = timeouts->entries_len;
+
+  timeouts->callbacks = NULL;
+  timeouts->len = 0;
+  if (!len) {
+    return;
+  }
 
-      return p;
+  TimeoutEntry **sorted = malloc(len * sizeof(TimeoutEntry *));
+  size_t i = 0;
+  for (TimeoutEntry *e = timeouts->entries; e; e = e->next) {
+    sorted[i++] = e;
+  }
+  qsort(sorted, len, sizeof(TimeoutEntry *), timeout_entry_cmp);
+
+  size_t groups = 1;
+  for (i = 1; i < len; ++i) {
+    if (sorted[i]->timeout != sorted[i - 1]->timeout) {
+      groups++;
     }
   }
-}
 
-Callbacks *timeouts_get_or_create(Timeouts *timeouts, uint32_t time) {
-  size_t index = timeouts_get_exact_or_next_index(timeouts, time);
-  if (index < timeouts->len) {
-    if (timeouts->callbacks[index].timeout != time) {
-      timeouts_insert_at(timeouts, index, time);
+  Callbacks *callbacks =
+      arena_alloc(timeouts->arena, groups * sizeof(Callbacks));
+  Command *cmds = arena_alloc(timeouts->arena, len * sizeof(Command));
+  Callbacks *current = NULL;
+  for (i = 0; i < len; ++i) {
+    if (!current || current->timeout != sorted[i]->timeout) {
+      current = current ? current + 1 : callbacks;
+      current->owner = timeouts;
+      current->timeout = sorted[i]->timeout;
+      current->cmds = cmds + i;
+      current->len = 0;
+      current->actions = 0;
+      current->latency = NULL;
+      current->spawned = 0;
+      current->failed = 0;
     }
-  } else {
-    timeouts_insert_at(timeouts, index, time);
+    Command *cmd = &current->cmds[current->len++];
+    command_compile(timeouts->arena, cmd, sorted[i]->cmd, sorted[i]->mode,
+                    sorted[i]->policy);
+    current->actions += cmd->action != NULL;
   }
-  return &timeouts->callbacks[index];
-}
+  free(sorted);
 
-void timeouts_append(Timeouts *timeouts, uint32_t time, char *cmd) {
-  callbacks_append(timeouts_get_or_create(timeouts, time), cmd);
+  timeouts->callbacks = callbacks;
+  timeouts->len = groups;
 }
 
-void timeouts_dup_append(Timeouts *timeouts, uint32_t time, char *cmd) {
-  callbacks_dup_append(timeouts_get_or_create(timeouts, time), cmd);
+/* Bytes taken by the configuration */
+size_t timeouts_footprint(Timeouts *timeouts) {
+  return sizeof(Timeouts) + sizeof(Arena) + timeouts->arena->allocated;
 }
 
-Callbacks *timeouts_get(Timeouts *timeouts, uint32_t time) {
+Callbacks *timeouts_get(Timeouts *timeouts, uint64_t time) {
   if (!timeouts->callbacks) {
     return NULL;
   }
@@ -217,44 +256,3 @@ int timeouts_inspect(Timeouts *timeouts,
 
   return 0;
 }
-
-size_t timeouts_exec_reset(Timeouts *timeouts) {
-  return callbacks_exec(timeouts_get(timeouts, 0));
-}
-
-size_t timeouts_exec(Timeouts *timeouts, uint32_t from, uint32_t to) {
-  size_t count = 0;
-
-  if (timeouts->callbacks) {
-    for (size_t i = 0; i < timeouts->len; ++i) {
-      Callbacks *callbacks = &timeouts->callbacks[i];
-      if (callbacks->timeout == 0) {
-        continue;
-      }
-
-      if (callbacks->timeout > to) {
-        break;
-      }
-
-      if (callbacks->timeout > from) {
-        count += callbacks_exec(callbacks);
-      }
-    }
-  }
-
-  return count;
-}
-
-uint32_t timeouts_next(Timeouts *timeouts, uint32_t timeout) {
-  size_t index = timeouts_get_exact_or_next_index(timeouts, timeout);
-  while (index < timeouts->len &&
-         timeouts->callbacks[index].timeout <= timeout) {
-    index++;
-  }
-
-  if (index >= timeouts->len) {
-    return 0;
-  } else {
-    return timeouts->callbacks[index].timeout;
-  }
-}
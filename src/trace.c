@@ -0,0 +1,166 @@
+#include "trace.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRACE_SIZE (sizeof(TraceHeader) + TRACE_RECORDS * sizeof(TraceRecord))
+
+int trace_file(const char *);
+void trace_keep(int, const char *);
+
+static struct trace {
+  TraceHeader *header;
+  TraceRecord *records;
+  int fd;
+} trace = {NULL, NULL, -1};
+
+/* $XDG_RUNTIME_DIR/xs-timeout.trace, NULL without a runtime directory */
+char *trace_path(void) {
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+
+  if (!dir || !*dir) {
+    return NULL;
+  }
+
+  char *res = malloc(strlen(dir) + sizeof("/xs-timeout.trace"));
+  strcpy(res, dir);
+  strcat(res, "/xs-timeout.trace");
+  return res;
+}
+
+/*
+ * The ring of the previous run, e.g. one that crashed, is copied to
+ * <path>.old before it is cleared.
+ */
+void trace_keep(int fd, const char *path) {
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    return;
+  }
+
+  size_t len = strlen(path);
+  char *old = malloc(len + sizeof(".old"));
+  memcpy(old, path, len);
+  memcpy(old + len, ".old", sizeof(".old"));
+
+  int out = open(old, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (out < 0) {
+    eprintf("Cannot open %s: %s\n", old, strerror(errno));
+    free(old);
+    return;
+  }
+
+  loff_t off = 0;
+  while (off < st.st_size) {
+    ssize_t n = copy_file_range(fd, &off, out, NULL, st.st_size - off, 0);
+    if (n <= 0) {
+      eprintf("Cannot copy the trace to %s: %s\n", old,
+              n < 0 ? strerror(errno) : "short file");
+      break;
+    }
+  }
+
+  close(out);
+  free(old);
+}
+
+/* A file owned by another instance is left alone */
+int trace_file(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+  if (fd < 0) {
+    eprintf("Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+    eprintf("%s is in use by another instance\n", path);
+    close(fd);
+    return -1;
+  }
+
+  trace_keep(fd, path);
+  if (ftruncate(fd, 0) < 0 || ftruncate(fd, TRACE_SIZE) < 0) {
+    eprintf("Cannot resize %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Without a file (or when it cannot be used) the records are only kept in
+ * memory, e.g. for a debugger.
+ */
+bool trace_open(const char *path) {
+  int flags = MAP_SHARED;
+  struct timespec real;
+
+  if (path && (trace.fd = trace_file(path)) < 0) {
+    eprintf("Tracing in memory only\n");
+  }
+  if (trace.fd < 0) {
+    flags |= MAP_ANONYMOUS;
+  }
+
+  void *map =
+      mmap(NULL, TRACE_SIZE, PROT_READ | PROT_WRITE, flags, trace.fd, 0);
+  if (map == MAP_FAILED) {
+    eprintf("Cannot map the trace: %s\n", strerror(errno));
+    trace_close();
+    return false;
+  }
+
+  trace.header = map;
+  trace.records = (TraceRecord *)(trace.header + 1);
+
+  clock_gettime(CLOCK_REALTIME, &real);
+  trace.header->version = TRACE_VERSION;
+  trace.header->record_size = sizeof(TraceRecord);
+  trace.header->capacity = TRACE_RECORDS;
+  trace.header->head = 0;
+  trace.header->realtime_offset =
+      (int64_t)(real.tv_sec * 1000000000ll + real.tv_nsec) -
+      (int64_t)monotonic_ns();
+  memcpy(trace.header->magic, TRACE_MAGIC, sizeof(trace.header->magic));
+  return true;
+}
+
+/* An atomic increment and a clock read: cheap enough to be always on */
+void trace_event(TraceType type, uint32_t id, uint64_t a, uint64_t b) {
+  if (!trace.header) {
+    return;
+  }
+
+  uint64_t n = __atomic_fetch_add(&trace.header->head, 1, __ATOMIC_RELAXED);
+  TraceRecord *record = &trace.records[n & (TRACE_RECORDS - 1)];
+
+  __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->time = monotonic_ns();
+  record->type = type;
+  record->id = id;
+  record->a = a;
+  record->b = b;
+  __atomic_store_n(&record->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void trace_close(void) {
+  if (trace.header) {
+    munmap(trace.header, TRACE_SIZE);
+    trace.header = NULL;
+    trace.records = NULL;
+  }
+  if (trace.fd >= 0) {
+    close(trace.fd);
+    trace.fd = -1;
+  }
+}
@@ -0,0 +1,73 @@
+#include "watch.h"
+#include "util.h"
+#include <errno.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_EVENTS                                                           \
+  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM)
+
+Watch *watch_new(const char *path) {
+  char *dir_buf = strdup(path);
+  char *name_buf = strdup(path);
+  Watch *res = calloc(1, sizeof(Watch));
+
+  res->wd = -1;
+  res->name = strdup(basename(name_buf));
+  free(name_buf);
+
+  if ((res->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+    eprintf("Cannot initialize inotify: %s\n", strerror(errno));
+    goto err;
+  }
+
+  if ((res->wd = inotify_add_watch(res->fd, dirname(dir_buf), WATCH_EVENTS)) <
+      0) {
+    eprintf("Cannot watch %s: %s\n", path, strerror(errno));
+    goto err;
+  }
+
+  free(dir_buf);
+  return res;
+err:
+  free(dir_buf);
+  watch_free(res);
+  return NULL;
+}
+
+int watch_fd(Watch *watch) { return watch->fd; }
+
+/* Consumes the pending events, true if any of them was about the file */
+bool watch_changed(Watch *watch) {
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool res = false;
+  ssize_t len;
+
+  while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len;) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      if (ev->len && strcmp(ev->name, watch->name) == 0) {
+        res = true;
+      }
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  return res;
+}
+
+void watch_free(Watch *watch) {
+  if (!watch) {
+    return;
+  }
+
+  if (watch->fd >= 0) {
+    close(watch->fd);
+  }
+  free(watch->name);
+  free(watch);
+}
@@ -0,0 +1,132 @@
+#include "source.h"
+#include "trace.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Prints the records of a trace written by xs-timeout, oldest first, with
+ * their wall clock time and the ms since the previous one:
+ *   xs-trace [<file>]
+ * The file can be read while xs-timeout is running.
+ */
+
+static const char *const results[] = {
+    [ERROR] = "error",     [TIMEOUT] = "timeout",   [UNIDLE] = "unidle",
+    [PENDING] = "pending", [FINISHED] = "finished",
+};
+
+void print_time(const TraceHeader *header, const TraceRecord *record,
+                uint64_t prev) {
+  int64_t real = (int64_t)record->time + header->realtime_offset;
+  time_t sec = (time_t)(real / 1000000000);
+  struct tm tm;
+  char buf[32];
+
+  localtime_r(&sec, &tm);
+  strftime(buf, sizeof(buf), "%F %T", &tm);
+  printf("%s.%06ld %+11.3f ", buf, (long)(real % 1000000000) / 1000,
+         prev ? (double)(int64_t)(record->time - prev) / 1e6 : 0.0);
+}
+
+void print_record(const TraceRecord *record) {
+  switch (record->type) {
+  case TRACE_ALARM_ARMED:
+    if (record->a) {
+      printf("alarm 0x%x armed at %ld%s\n", record->id, (int64_t)record->a,
+             record->b ? " (relative)" : "");
+    } else {
+      printf("alarm 0x%x armed for activity\n", record->id);
+    }
+    break;
+  case TRACE_ALARM_FIRED:
+    printf("alarm 0x%x fired, counter %ld, alarm value %ld\n", record->id,
+           (int64_t)record->a, (int64_t)record->b);
+    break;
+  case TRACE_STATE:
+    printf("session %lu %s, cursor %lu\n", record->a,
+           record->id < sizeof(results) / sizeof(results[0])
+               ? results[record->id]
+               : "?",
+           record->b);
+    break;
+  case TRACE_SPAWN:
+    printf("spawned %u command%s, pid %ld, in %.3f ms\n", record->id,
+           record->id == 1 ? "" : "s", (int64_t)record->a,
+           (double)record->b / 1e6);
+    break;
+  case TRACE_SIGNAL:
+    printf("signal %s from %lu\n", strsignal((int)record->id), record->a);
+    break;
+  default:
+    printf("unknown record %u\n", record->type);
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  char *path = argc > 1 ? strdup(argv[1]) : trace_path();
+  struct stat st;
+
+  if (!path || argc > 2) {
+    eprintf("USAGE: xs-trace [<file>]\n");
+    free(path);
+    return 1;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    eprintf("Cannot open %s: %s\n", path, strerror(errno));
+    free(path);
+    return 1;
+  }
+
+  void *map = NULL;
+  if ((size_t)st.st_size >= sizeof(TraceHeader)) {
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  const TraceHeader *header = map == MAP_FAILED ? NULL : map;
+  if (!header || memcmp(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+      header->version != TRACE_VERSION ||
+      header->record_size != sizeof(TraceRecord) ||
+      (header->capacity & (header->capacity - 1)) ||
+      (size_t)st.st_size <
+          sizeof(TraceHeader) + header->capacity * sizeof(TraceRecord)) {
+    eprintf("%s is not a trace of this version\n", path);
+    free(path);
+    return 1;
+  }
+
+  const TraceRecord *records = (const TraceRecord *)(header + 1);
+  uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  uint64_t start = head > header->capacity ? head - header->capacity : 0;
+  uint64_t prev = 0;
+
+  for (uint64_t n = start; n < head; ++n) {
+    const TraceRecord *slot = &records[n & (header->capacity - 1)];
+    /* overwritten meanwhile, or still being written */
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != n + 1) {
+      continue;
+    }
+    TraceRecord record = *slot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != n + 1) {
+      continue;
+    }
+    print_time(header, &record, prev);
+    print_record(&record);
+    prev = record.time;
+  }
+
+  munmap(map, (size_t)st.st_size);
+  free(path);
+  return 0;
+}